@@ -17,9 +17,11 @@ uniform vec2 pxsize;
 uniform sampler2D inputGrid;
 
 uniform ivec2 moveDirection;// each component in {-1,0,1}
-uniform float BIRTH_THRESHOLD;// in [0,1]
-uniform float DEATH_THRESHOLD;// in [0,1]
-uniform float ROOM_NBORS_AHEAD_THRESHOLD;// in [0,1]
+// Thresholds in [0,1] are converted to neighbor counts on the CPU
+// (see OuterInfluenceRules), so that the CPU backend gives identical results
+uniform int BIRTH_MIN_NBORS_BEHIND;// birth if neighbors behind >= this
+uniform int DEATH_MIN_NBORS_BEHIND;// death if neighbors behind < this
+uniform int SPLIT_MIN_ROOM_NBORS_AHEAD;// split if room neighbors ahead >= this
 uniform int OUTER_INFL_NBORS_THRESHOLD;// integer from 0 to 8
 uniform int DAMAGE_PER_CELL;// integer from 0 to 100
 
@@ -46,7 +48,7 @@ int countNeighborsWithState(uint state, ivec2 start, ivec2 end);
 ivec4 countNeighborsWithStateDirected(uint state, ivec2 start, ivec2 end);
 
 uvec2 lookup(sampler2D s, vec2 c) {
-	return uvec2(texture(s,c).rg * 255); // convert UNORM to uint
+	return uvec2(texture(s,c).rg * 255.0 + 0.5); // convert UNORM to uint
 }
 
 void setOutput(uint buildState, uint healthPoints) {
@@ -76,18 +78,18 @@ void life(uint state, int neighbors) {
 //      considered to follow behind the current cell.
 //    - Outer influence cell is born, if enough
 //      other outer influence cells follow behind it
-//      (more than BIRTH_THRESHOLD).
+//      (at least BIRTH_MIN_NBORS_BEHIND).
 //    - Outer influence cell dies, if too few other
 //      outer influence cells follow behind it
-//      (fewer than DEATH_THRESHOLD).
+//      (fewer than DEATH_MIN_NBORS_BEHIND).
 // 2) Split:
 //    - As response to a collision with a room, outer
 //      influence body "splits".
 //    - Split rule takes the new state after the move rule.
 //    - Outer influence cell is born next to at least
 //      OUTER_INFL_NBORS_THRESHOLD other outer influence
-//      cells, if enough room cells are ahead (more than
-//      ROOM_NBORS_AHEAD_THRESHOLD).
+//      cells, if enough room cells are ahead (at least
+//      SPLIT_MIN_ROOM_NBORS_AHEAD).
 // 3) Damage:
 //    - Room cell health decreases by the value of
 //      DAMAGE_PER_CELL for each outer influence neighbor.
@@ -102,16 +104,9 @@ uint applyMoveRule(uint st, ivec4 nbors, ivec2 movDir) {
 	if(movDir.y!=0) {
 		nborsBehind += (movDir.y>0) ? nbors.w : nbors.y;
 	}
-	float nborsBehindNormalized = nborsBehind;
-	if(movDir.x!=0 && movDir.y!=0) {
-		nborsBehindNormalized /= 6.0;
-	}
-	else {
-		nborsBehindNormalized /= 3.0;
-	}
-	if (st==BSTATE_EMPTY && nborsBehindNormalized>BIRTH_THRESHOLD)
+	if (st==BSTATE_EMPTY && nborsBehind>=BIRTH_MIN_NBORS_BEHIND)
 		return BSTATE_OUTER_INFLUENCE; // birth
-	else if (st==BSTATE_OUTER_INFLUENCE && nborsBehindNormalized<DEATH_THRESHOLD)
+	else if (st==BSTATE_OUTER_INFLUENCE && nborsBehind<DEATH_MIN_NBORS_BEHIND)
 		return BSTATE_EMPTY; // death
 	else
 		return st; // remain dead/alive
@@ -126,10 +121,7 @@ uint applySplitRule(uint st, ivec4 roomNbors, int outerInflNbors, ivec2 movDir)
 	if(movDir.y!=0) {
 		roomNborsAhead += (movDir.y>0) ? roomNbors.y : roomNbors.w;
 	}
-	float roomNborsAheadNormalized = roomNborsAhead;
-	if(movDir.x!=0 && movDir.y!=0) roomNborsAheadNormalized /= 6.0;
-	else roomNborsAheadNormalized /= 3.0;
-	if(roomNborsAheadNormalized>ROOM_NBORS_AHEAD_THRESHOLD
+	if(roomNborsAhead>=SPLIT_MIN_ROOM_NBORS_AHEAD
 		&& outerInflNbors>=OUTER_INFL_NBORS_THRESHOLD) return BSTATE_OUTER_INFLUENCE;
 	else return st;
 }
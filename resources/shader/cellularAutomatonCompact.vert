@@ -0,0 +1,17 @@
+#version 330
+
+// One vertex per cell, compares the new generation against the previous one
+uniform sampler2D currentGrid;
+uniform sampler2D previousGrid;
+uniform int gridColumns;
+
+flat out uvec2 cell; // x = cell index, y = state | (hp << 8)
+flat out uint changed;
+
+void main() {
+	ivec2 texel = ivec2(gl_VertexID % gridColumns, gl_VertexID / gridColumns);
+	uvec2 now = uvec2(texelFetch(currentGrid, texel, 0).rg * 255.0 + 0.5); // convert UNORM to uint
+	uvec2 before = uvec2(texelFetch(previousGrid, texel, 0).rg * 255.0 + 0.5);
+	cell = uvec2(uint(gl_VertexID), now.r | (now.g << 8));
+	changed = (now != before) ? 1U : 0U;
+}
\ No newline at end of file
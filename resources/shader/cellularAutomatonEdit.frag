@@ -0,0 +1,9 @@
+#version 330
+
+flat in vec2 stateHealth;
+
+out vec2 outputCell;
+
+void main() {
+	outputCell = stateHealth;
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 330
+
+// One point per edited cell, rendered into the current automaton generation
+layout(location = 0) in uvec2 cell; // x = cell index, y = state | (hp << 8)
+
+uniform int gridColumns;
+uniform vec2 pxsize;
+
+flat out vec2 stateHealth;
+
+void main() {
+	uint cols = uint(gridColumns);
+	vec2 texel = vec2(float(cell.x % cols), float(cell.x / cols)) + 0.5; // texel center
+	gl_Position = vec4(texel * pxsize * 2.0 - 1.0, 0.0, 1.0);
+	gl_PointSize = 1.0;
+	stateHealth = vec2(float(cell.y & 0xFFU), float((cell.y >> 8) & 0xFFU)) / 255.0; // convert uint to UNORM
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#version 330 core
+
+#define BSTATE_OUTER_INFLUENCE 11
+
+// Packed pool geometry of the mesh drawn for the cells (no instance attribs)
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 texCoords;
+layout(location = 7) in int subMeshIndex;
+
+uniform samplerBuffer subMeshData; // 5 texels per sub mesh: local matrix columns, material layers
+uniform mat4 viewProjectionMatrix;
+// Cells are split between the mesh variations by cell index
+uniform int variation;
+uniform int numVariations;
+// Drawn cells: first column, first row, columns, rows (visible tiles of the frustum culling)
+uniform ivec4 cellRect;
+
+// Automaton state per cell (red: build state, green: health)
+uniform sampler2D gridTex;
+uniform sampler2D gridTex_PrevState;
+
+// Per-frame state of the mesh pool (RoomSegmentMeshPool::FrameUniforms)
+layout(std140) uniform PoolFrame {
+	vec3 gridTranslation;
+	float gridCellSize;
+	vec2 gridDimensions;
+	float automatonTimeDelta;
+	float t_sec;
+};
+
+out vec3 vPosition;
+out vec3 vNormal;
+out vec2 vTexCoords;
+
+flat out int st;
+flat out int hp;
+flat out ivec4 material; // diffuse array, diffuse layer, bump array, bump layer (-1 for none)
+out vec2 cellCoords;
+
+void main() {
+	// One instance per cell of the rect, in the same order as the cells in the automaton texture
+	ivec2 gridSize = textureSize(gridTex, 0);
+	ivec2 cell = cellRect.xy + ivec2(gl_InstanceID % cellRect.z, gl_InstanceID / cellRect.z);
+	int cellIndex = cell.y * gridSize.x + cell.x;
+	ivec2 latest = ivec2(round(texelFetch(gridTex, cell, 0).rg * 255.0));
+	ivec2 previous = ivec2(round(texelFetch(gridTex_PrevState, cell, 0).rg * 255.0));
+
+	st = BSTATE_OUTER_INFLUENCE;
+	hp = (latest.r == BSTATE_OUTER_INFLUENCE) ? latest.g : previous.g;
+	material = ivec4(texelFetch(subMeshData, 5 * subMeshIndex + 4));
+	vTexCoords = texCoords;
+
+	// Cull cells without outer influence (cells of the previous state still fade out)
+	if((latest.r != BSTATE_OUTER_INFLUENCE && previous.r != BSTATE_OUTER_INFLUENCE)
+		|| cellIndex % numVariations != variation) {
+		vPosition = vec3(0);
+		vNormal = vec3(0);
+		cellCoords = vec2(0);
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // all vertices outside the clip volume
+		return;
+	}
+
+	// Same placement as MeshInstanceGrid::addInstanceAt (grid origin at (-1,-1))
+	vec3 translation = gridTranslation;
+	translation.xy += vec2(-1.0) + vec2(cell) * gridCellSize + vec2(0.5, -0.5) * gridCellSize;
+	float scale = gridCellSize / 2.0;
+
+	cellCoords = translation.xy + vec2(1, 1 + gridCellSize) - gridTranslation.xy;
+	cellCoords += (texCoords.yx - 0.5) * gridCellSize;
+	cellCoords /= gridDimensions;
+
+	int i = 5 * subMeshIndex;
+	mat4 localMatrix = mat4(texelFetch(subMeshData, i), texelFetch(subMeshData, i + 1),
+		texelFetch(subMeshData, i + 2), texelFetch(subMeshData, i + 3));
+	vec4 posV4 = localMatrix * vec4(position.x, -position.z, position.y, 1);
+	posV4.xyz = scale * posV4.xyz + translation * posV4.w;
+	vPosition = vec3(posV4);
+	vNormal = vec3(normal.x, -normal.z, normal.y);
+
+	gl_Position = viewProjectionMatrix * posV4;
+}
\ No newline at end of file
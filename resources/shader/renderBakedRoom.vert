@@ -0,0 +1,31 @@
+#version 330 core
+
+// Vertices of a finished room, already in world space (see BakedRoom)
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 texCoords;
+layout(location = 3) in int buildState;
+layout(location = 4) in int health;
+layout(location = 5) in ivec4 materialLayers; // same as the sub mesh data of the pool
+
+uniform mat4 viewProjectionMatrix;
+
+out vec3 vPosition;
+out vec3 vNormal;
+out vec2 vTexCoords;
+
+flat out int st;
+flat out int hp;
+flat out ivec4 material;
+out vec2 cellCoords; // only used for outer influence
+
+void main() {
+	st = buildState;
+	hp = health;
+	material = materialLayers;
+	cellCoords = vec2(0);
+	vPosition = position;
+	vNormal = normal;
+	vTexCoords = texCoords;
+	gl_Position = viewProjectionMatrix * vec4(position, 1);
+}
\ No newline at end of file
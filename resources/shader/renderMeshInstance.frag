@@ -13,7 +13,8 @@
 #define BSTATE_INVALID 10
 #define BSTATE_OUTER_INFLUENCE 11
 
-// uniform sampler2D diffuseTexture;
+// Material textures of the pool meshes, one array per resolution
+uniform sampler2DArray materialTextures[4];
 
 in vec3 vPosition;
 in vec3 vNormal;
@@ -21,11 +22,20 @@ in vec2 vTexCoords;
 
 flat in int st;
 flat in int hp;
+flat in ivec4 material;
 
 in vec2 cellCoords;
 uniform sampler2D gridTex;
 uniform sampler2D gridTex_PrevState;
-uniform float automatonTimeDelta;
+
+// Per-frame state of the mesh pool (RoomSegmentMeshPool::FrameUniforms)
+layout(std140) uniform PoolFrame {
+	vec3 gridTranslation;
+	float gridCellSize;
+	vec2 gridDimensions;
+	float automatonTimeDelta;
+	float t_sec;
+};
 
 uniform int isDepthPass;
 uniform int isDebugMode;
@@ -35,6 +45,20 @@ const float OUTER_INFLUENCE_DISPLAY_THRESHOLD = 0.6;
 
 out vec4 color;
 
+vec4 sampleMaterial(int arrayIndex, int layer) {
+	// Gradients outside of the branch (array index is not uniform across a multi-draw)
+	vec2 dx = dFdx(vTexCoords);
+	vec2 dy = dFdy(vTexCoords);
+	vec3 uvw = vec3(vTexCoords, layer);
+	switch(arrayIndex) {
+		case 0: return textureGrad(materialTextures[0], uvw, dx, dy);
+		case 1: return textureGrad(materialTextures[1], uvw, dx, dy);
+		case 2: return textureGrad(materialTextures[2], uvw, dx, dy);
+		case 3: return textureGrad(materialTextures[3], uvw, dx, dy);
+		default: return vec4(1);
+	}
+}
+
 void main() {
 	if(isDepthPass == 1) return;
 	if(isDebugMode == 1) {
@@ -66,5 +90,6 @@ void main() {
 	}
 	else {
 		color = vec4(vNormal, 1) * healthNormalized;
+		if(material.x >= 0) color *= sampleMaterial(material.x, material.y);
 	}
 }
\ No newline at end of file
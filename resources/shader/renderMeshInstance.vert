@@ -22,22 +22,26 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 texCoords;
 
-// Instance attribs
-layout(location = 3) in vec3 translation;
-layout(location = 4) in float scale;
-layout(location = 5) in int buildState;
-layout(location = 6) in int health;
-
-uniform mat4 subMeshLocalMatrix;
-uniform mat3 normalMatrix;
-uniform mat4 viewProjectionMatrix;
+// Instance attrib (RoomSegmentMesh::Instance): cell index, build state << 20, health << 24
+layout(location = 3) in uint instanceData;
+// Decoded in main
+int buildState;
+int health;
+
+// Packed pool geometry: index into subMeshData
+layout(location = 7) in int subMeshIndex;
 
-uniform vec2 gridDimensions;
-uniform vec3 gridTranslation;
-uniform float gridCellSize;
-uniform float automatonTimeDelta;
+uniform samplerBuffer subMeshData; // 5 texels per sub mesh: local matrix columns, material layers
+uniform mat4 viewProjectionMatrix;
 
-uniform float t_sec;
+// Per-frame state of the mesh pool (RoomSegmentMeshPool::FrameUniforms)
+layout(std140) uniform PoolFrame {
+	vec3 gridTranslation;
+	float gridCellSize;
+	vec2 gridDimensions;
+	float automatonTimeDelta;
+	float t_sec;
+};
 
 out vec3 vPosition;
 out vec3 vNormal;
@@ -64,9 +68,26 @@ vec2 rotateZ_step90(int st, float x, float y) {
 
 flat out int st;
 flat out int hp;
+flat out ivec4 material; // diffuse array, diffuse layer, bump array, bump layer (-1 for none)
 out vec2 cellCoords;
 
+mat4 getSubMeshLocalMatrix() {
+	int i = 5 * subMeshIndex;
+	return mat4(texelFetch(subMeshData, i), texelFetch(subMeshData, i + 1),
+		texelFetch(subMeshData, i + 2), texelFetch(subMeshData, i + 3));
+}
+
 void main() {
+	int cell = int(instanceData & 0xFFFFFu);
+	buildState = int((instanceData >> 20) & 0xFu);
+	health = int(instanceData >> 24);
+	// Same placement as MeshInstanceGrid cells (grid origin at (-1,-1), model extends [-1,1]^3)
+	int gridColumns = int(gridDimensions.x / gridCellSize + 0.5);
+	vec3 translation = gridTranslation;
+	translation.xy += vec2(-1.0) + vec2(cell % gridColumns, cell / gridColumns) * gridCellSize;
+	translation.xy += vec2(0.5, -0.5) * gridCellSize;
+	float scale = (buildState == BSTATE_EMPTY) ? 0.0 : gridCellSize / 2.0; // hidden instance
+
 	mat4 modelMatrix = mat4(0); // this fixed the glitch
 	modelMatrix[3] = vec4(translation, 1);
 	modelMatrix[0][0] = scale;
@@ -75,6 +96,7 @@ void main() {
 
 	st = buildState;
 	hp = health;
+	material = ivec4(texelFetch(subMeshData, 5 * subMeshIndex + 4));
 	cellCoords = translation.xy + vec2(1, 1 + gridCellSize) - gridTranslation.xy;
 	cellCoords += (texCoords.yx - 0.5) * gridCellSize;
 	cellCoords /= gridDimensions;
@@ -86,7 +108,7 @@ void main() {
 		//modelMatrix[3][2] += ((1.0 + sin(t_sec * WATER_WAVE_DIRECTION * WATER_WAVE_LENGTH)) / WATER_WAVE_HEIGHT);
 	}
 
-	vec4 posV4 = modelMatrix * subMeshLocalMatrix * vec4(rotateZ_step90(buildState, position.x, -position.z), position.y, 1);
+	vec4 posV4 = modelMatrix * getSubMeshLocalMatrix() * vec4(rotateZ_step90(buildState, position.x, -position.z), position.y, 1);
 	vPosition = vec3(posV4);
 	vNormal = vec3(rotateZ_step90(buildState, normal.x, -normal.z), normal.y); //TODO incorporate sin wave
 	vTexCoords = texCoords;
@@ -15,6 +15,7 @@
 
 #define GRID_COLUMNS 64
 #define GRID_ROWS 64
+#define UPLOAD_BUFFER_SECTION_BYTES (4 << 20)
 
 static float automaton_transition_time = 0.04f;
 static int automaton_movedir_[2] = { 1,0 };
@@ -23,6 +24,14 @@ static float automaton_death_thd = 0.5f;
 static float automaton_collision_thd = 0.2f;
 static int automaton_outer_infl_nbors_thd = 2;
 static int automaton_damage_per_cell = 5;
+static int automaton_readback_latency = 1;
+static bool automaton_on_cpu = false;
+static int automaton_cpu_threads = 0; // 0 = keep the automaton's default
+static int automaton_cpu_kernel = -1; // -1 = keep the automaton's default
+static int shadow_quality = (int)ShadowMap::MEDIUM;
+static bool outer_influence_on_gpu = false;
+static bool frustum_culling = true;
+static bool replicate_grid_state = true;
 
 namespace viscom {
 
@@ -33,7 +42,9 @@ namespace viscom {
 		interaction_mode_(GRID_PLACE_OUTER_INFLUENCE),
 		camera_(glm::mat4(1)),
 		cellular_automaton_(&grid_, automaton_transition_time),
+		shadow_fit_version_(0),
 		render_mode_(NORMAL),
+		grid_state_received_(false),
 		clock_{0.0}
     {
     }
@@ -46,6 +57,10 @@ namespace viscom {
 
     void ApplicationNodeImplementation::InitOpenGL()
     {
+		upload_buffer_ = new StreamingBuffer(UPLOAD_BUFFER_SECTION_BYTES);
+		meshpool_.setUploadBuffer(upload_buffer_);
+		grid_.setUploadBuffer(upload_buffer_);
+		cellular_automaton_.setUploadBuffer(upload_buffer_);
 		meshpool_.loadShader(appNode_->GetGPUProgramManager());
 		meshpool_.addMesh({ GridCell::BuildState::INSIDE_ROOM },
 							appNode_->GetMeshManager().GetResource("/models/roomgame_models/floor.obj"));
@@ -63,10 +78,6 @@ namespace viscom {
 		meshpool_.addMesh({ GridCell::BuildState::OUTER_INFLUENCE },
 							appNode_->GetMeshManager().GetResource("/models/roomgame_models/latticeplane.obj"));
 
-		meshpool_.updateUniformEveryFrame("t_sec", [this](GLint uloc) {
-			glUniform1f(uloc, (float)clock_.t_in_sec);
-		});
-
 		grid_.onMeshpoolInitialized();
 		grid_.loadShader(appNode_->GetGPUProgramManager());
 		grid_.uploadVertexData();
@@ -80,22 +91,43 @@ namespace viscom {
 		backgroundMesh_->transform(glm::scale(glm::translate(glm::mat4(1), 
 			glm::vec3(0,-grid_.getCellSize(),-0.001f/*TODO better remove the z bias and use thicker meshes*/)), glm::vec3(1.0f)));
 
-		shadowMap_ = new ShadowMap(1024, 1024);
+		shadowMap_ = new ShadowMap((ShadowMap::Quality)shadow_quality);
 		shadowMap_->setLightMatrix(glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0), glm::vec3(0, 1, 0)));
+		// Own projection, so the light space is the same for all windows of this node
+		// (refitted to the casters in DrawFrame)
+		shadowMap_->setLightProjection(glm::ortho(-1.5f, 1.5f, -1.5f, 1.5f, 0.1f, 7.0f));
 		
 		GetEngine()->setNearAndFarClippingPlanes(0.1f, 100.0f);
+		upload_buffer_->endFrame(); // fence the uploads of the init
     }
 
     void ApplicationNodeImplementation::PreSync()
     {
+		if (!GetEngine()->isMaster()) return;
+		// State of the last frame, slaves are one frame behind at most
+		grid_replication_synced_.setVal(replicate_grid_state);
+		grid_transition_time_synced_.setVal(automaton_transition_time);
+		std::vector<GLubyte> message;
+		// Grid lags the automaton texture by the readback latency, its generation is sent along
+		if (replicate_grid_state)
+			grid_replication_.encode(grid_.getCellStorage()->getStateHealthData(),
+				2 * grid_.getNumColumns() * grid_.getNumRows(), cellular_automaton_.getAppliedGeneration(), message);
+		else grid_replication_.reset(); // next message is a snapshot
+		grid_state_synced_.setVal(message);
     }
 
     void ApplicationNodeImplementation::UpdateSyncedInfo()
     {
+		if (GetEngine()->isMaster()) return;
+		std::vector<GLubyte> message = grid_state_synced_.getVal();
+		grid_state_synced_.clear();
+		if (!grid_replication_synced_.getVal()) grid_replication_.reset();
+		else if (!message.empty()) grid_state_received_ = grid_replication_.decode(message);
     }
 
     void ApplicationNodeImplementation::UpdateFrame(double currentTime, double elapsedTime)
     {
+		upload_buffer_->beginFrame();
 		cellular_automaton_.setTransitionTime(automaton_transition_time);
 		cellular_automaton_.setMoveDir(automaton_movedir_[0], automaton_movedir_[1]);
 		cellular_automaton_.setBirthThreshold(automaton_birth_thd);
@@ -103,8 +135,26 @@ namespace viscom {
 		cellular_automaton_.setCollisionThreshold(automaton_collision_thd);
 		cellular_automaton_.setOuterInfluenceNeighborThreshold(automaton_outer_infl_nbors_thd);
 		cellular_automaton_.setDamagePerCell(automaton_damage_per_cell);
-		cellular_automaton_.transition(currentTime);
+		cellular_automaton_.setReadbackLatency((size_t)automaton_readback_latency);
+		cellular_automaton_.setCpuBackend(automaton_on_cpu);
+		if (automaton_cpu_threads > 0) cellular_automaton_.setCpuThreads((size_t)automaton_cpu_threads);
+		if (automaton_cpu_kernel >= 0) cellular_automaton_.setCpuKernel((OuterInfluenceRules::Kernel)automaton_cpu_kernel);
+		if (!GetEngine()->isMaster() && grid_replication_synced_.getVal()) {
+			// Replicated state replaces the local simulation
+			cellular_automaton_.setTransitionTime(grid_transition_time_synced_.getVal());
+			if (grid_state_received_)
+				cellular_automaton_.applyReplicatedState(grid_replication_.getState().data(),
+					grid_replication_.getChangedCells(), grid_replication_.getGeneration(), currentTime);
+			grid_state_received_ = false;
+			cellular_automaton_.advanceReplicatedClock(currentTime);
+		}
+		else cellular_automaton_.transition(currentTime);
+		grid_.setGpuDrivenOuterInfluence(outer_influence_on_gpu);
+		grid_.commitEdits(); // user input and automaton results of this frame
 		clock_.t_in_sec = currentTime;
+		meshpool_.setTime((float)clock_.t_in_sec);
+		shadowMap_->setQuality((ShadowMap::Quality)shadow_quality);
+		meshpool_.setFrustumCulling(frustum_culling);
     }
 
     void ApplicationNodeImplementation::ClearBuffer(FrameBuffer& fbo)
@@ -114,20 +164,26 @@ namespace viscom {
             glClearColor(colorPtr[0], colorPtr[1], colorPtr[2], colorPtr[3]);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         });
-
-		shadowMap_->DrawToFBO([&]() {
-			glClearDepth(1.0f);
-			glClear(GL_DEPTH_BUFFER_BIT);
-		});
+		// Shadow map is cleared when it is re-rendered (see DrawFrame)
     }
 
     void ApplicationNodeImplementation::DrawFrame(FrameBuffer& fbo)
     {
 		glm::mat4 proj = GetEngine()->getCurrentModelViewProjectionMatrix() * camera_.getViewProjection();
-		glm::mat4 lightspace = GetEngine()->getCurrentModelViewProjectionMatrix() * shadowMap_->getLightMatrix();
 		grid_.updateProjection(proj);
 		
-		shadowMap_->DrawToFBO([&]() {
+		// Fit the light frustum to the casters whenever they change
+		size_t caster_version = meshpool_.getInstanceVersionExcept(GridCell::BuildState::OUTER_INFLUENCE);
+		if (caster_version != shadow_fit_version_) {
+			viscom::math::AABB3<float> casters;
+			if (meshpool_.getInstanceBoundsExcept(GridCell::BuildState::OUTER_INFLUENCE, casters))
+				shadowMap_->fitLightProjection(casters, backgroundMesh_->getBoundingBox());
+			shadow_fit_version_ = caster_version;
+		}
+		glm::mat4 lightspace = shadowMap_->getLightSpaceMatrix();
+		
+		// Rendered by the first window after a change, reused by the other windows
+		shadowMap_->update(lightspace, caster_version, [&]() {
 			meshpool_.renderAllMeshesExcept(lightspace, GridCell::BuildState::OUTER_INFLUENCE, 1);
 		});
 		
@@ -149,6 +205,27 @@ namespace viscom {
 			if (ImGui::Begin("Roomgame Controls")) {
 				//ImGui::SetWindowFontScale(2.0f);
 				ImGui::Text("Interaction mode: %s", (interaction_mode_==GRID)?"GRID":((interaction_mode_==GRID_PLACE_OUTER_INFLUENCE)?"GRID_PLACE_OUTER_INFLUENCE":"CAMERA"));
+				ImGui::Text("grid uploads last commit: %d", (int)grid_.getNumUploadsLastCommit());
+				ImGui::Text("upload buffer (%s): %d bytes in %d uploads last frame, stalls: %d, overflows: %d",
+					upload_buffer_->isPersistent() ? "persistent" : "buffer sub data",
+					(int)upload_buffer_->getBytesLastFrame(), (int)upload_buffer_->getUploadsLastFrame(),
+					(int)upload_buffer_->getNumStalls(), (int)upload_buffer_->getNumOverflows());
+				if (ImGui::CollapsingHeader("instance buffers")) {
+					for (const RoomSegmentMeshPool::InstanceStatistics& s : meshpool_.getInstanceStatistics())
+						ImGui::Text("type %d: %d live, %d peak, %d in rooms, pool %d, capacity %d, reallocs %d",
+							(int)s.type, s.num_instances, s.high_water_instances, s.num_room_ordered_instances,
+							(int)s.pool_allocation_instances, (int)s.capacity_instances, (int)s.num_reallocations);
+					ImGui::Text("mesh pool draw calls last pass: %d (%s)", (int)meshpool_.getNumDrawCallsLastPass(),
+						meshpool_.isMultiDrawIndirect() ? "multi-draw indirect" : "fallback loop");
+					ImGui::Text("pool frame uniform uploads: %d", (int)meshpool_.getNumFrameUniformUploads());
+					ImGui::Checkbox("frustum culling", &frustum_culling);
+					ImGui::Text("visible tiles last pass: %d of %d, instances drawn: %d of %d",
+						(int)meshpool_.getNumVisibleTilesLastPass(), (int)meshpool_.getNumTiles(),
+						(int)meshpool_.getNumDrawnInstancesLastPass(), (int)meshpool_.getNumInstancesLastPass());
+					ImGui::Text("shadow map renders: %d, skipped: %d", (int)shadowMap_->getNumRenders(), (int)shadowMap_->getNumSkips());
+					ImGui::Combo("shadow quality", &shadow_quality, "low (512)\0medium (1024)\0high (2048)\0");
+					ImGui::Text("baked rooms: %d, re-bakes: %d", (int)meshpool_.getNumBakedRooms(), (int)meshpool_.getNumRebakes());
+				}
 				ImGui::Text("AUTOMATON");
 				ImGui::SliderFloat("transition time", &automaton_transition_time, 0.017f, 1.0f);
 				ImGui::SliderInt2("move direction", automaton_movedir_, -1, 1);
@@ -157,6 +234,26 @@ namespace viscom {
 				ImGui::SliderFloat("ROOM_NBORS_AHEAD_THRESHOLD", &automaton_collision_thd, 0.0f, 1.0f);
 				ImGui::SliderInt("OUTER_INFL_NBORS_THRESHOLD", &automaton_outer_infl_nbors_thd, 1, 8);
 				ImGui::SliderInt("DAMAGE_PER_CELL", &automaton_damage_per_cell, 1, 100);
+				ImGui::SliderInt("readback latency", &automaton_readback_latency, 0, 4);
+				ImGui::Text("readbacks pending: %d, not signaled: %d, forced waits: %d, dropped: %d",
+					(int)cellular_automaton_.getNumPendingReadbacks(),
+					(int)cellular_automaton_.getNumFencesNotSignaled(),
+					(int)cellular_automaton_.getNumForcedWaits(),
+					(int)cellular_automaton_.getNumDroppedReadbacks());
+				ImGui::Text("changed cells: %d", (int)cellular_automaton_.getNumChangedCells());
+				ImGui::Checkbox("simulate on CPU", &automaton_on_cpu);
+				ImGui::Checkbox("draw outer influence from automaton texture", &outer_influence_on_gpu);
+				if (automaton_cpu_kernel < 0) automaton_cpu_kernel = (int)cellular_automaton_.getCpuKernel();
+				ImGui::SliderInt("CPU kernel", &automaton_cpu_kernel, 0, (int)OuterInfluenceRules::getBestKernel(),
+					OuterInfluenceRules::getKernelName((OuterInfluenceRules::Kernel)automaton_cpu_kernel));
+				if (automaton_cpu_threads == 0) automaton_cpu_threads = (int)cellular_automaton_.getCpuThreads();
+				ImGui::SliderInt("CPU threads", &automaton_cpu_threads, 1, 64);
+				ImGui::Text("CPU step: %.2f ms, tiles stolen: %d", cellular_automaton_.getCpuStepMilliseconds(),
+					(int)cellular_automaton_.getCpuSteals());
+				ImGui::Checkbox("replicate grid state to slaves", &replicate_grid_state);
+				ImGui::Text("replication: %d bytes last frame, %d bytes total, %d deltas, %d snapshots",
+					(int)grid_replication_.getBytesLastMessage(), (int)grid_replication_.getTotalBytes(),
+					(int)grid_replication_.getNumDeltas(), (int)grid_replication_.getNumSnapshots());
 			}
 			ImGui::End();
         });
@@ -164,6 +261,7 @@ namespace viscom {
 
     void ApplicationNodeImplementation::PostDraw()
     {
+		upload_buffer_->endFrame();
 		GLenum e;
 		while((e = glGetError()) != GL_NO_ERROR)
 			printf("Something went wrong during the last frame (GL error %x).\n", e);
@@ -176,6 +274,7 @@ namespace viscom {
 		cellular_automaton_.cleanup();
 		delete shadowMap_;
 		delete backgroundMesh_;
+		delete upload_buffer_;
     }
 
     // ReSharper disable CppParameterNeverUsed
@@ -267,9 +366,15 @@ namespace viscom {
 
     void ApplicationNodeImplementation::EncodeData()
     {
+		sgct::SharedData::instance()->writeBool(&grid_replication_synced_);
+		sgct::SharedData::instance()->writeFloat(&grid_transition_time_synced_);
+		sgct::SharedData::instance()->writeVector(&grid_state_synced_);
     }
 
     void ApplicationNodeImplementation::DecodeData()
     {
+		sgct::SharedData::instance()->readBool(&grid_replication_synced_);
+		sgct::SharedData::instance()->readFloat(&grid_transition_time_synced_);
+		sgct::SharedData::instance()->readVector(&grid_state_synced_);
     }
 }
@@ -16,6 +16,8 @@
 #include "app/roomgame/OuterInfluenceAutomaton.h"
 #include "app/roomgame/GameMesh.h"
 #include "app/roomgame/ShadowMap.h"
+#include "app/roomgame/StreamingBuffer.h"
+#include "app/roomgame/GridStateReplication.h"
 
 namespace viscom {
 
@@ -77,8 +79,16 @@ namespace viscom {
 		enum InteractionMode { GRID, CAMERA, GRID_PLACE_OUTER_INFLUENCE } interaction_mode_;
 		OuterInfluenceAutomaton cellular_automaton_;
 		ShadowMap* shadowMap_;
+		StreamingBuffer* upload_buffer_; // per-frame uploads of all subsystems
 		ShadowReceivingMesh* backgroundMesh_;
+		size_t shadow_fit_version_; // caster version the light frustum was fitted to
 		enum RenderMode { NORMAL, DBUG } render_mode_;
+		// Only the master simulates, slaves apply its grid state
+		GridStateReplication grid_replication_;
+		sgct::SharedVector<GLubyte> grid_state_synced_; // encoded message, empty if unchanged
+		sgct::SharedBool grid_replication_synced_;
+		sgct::SharedFloat grid_transition_time_synced_; // slaves fade between generations at the master's pace
+		bool grid_state_received_;
 
 		struct Clock {
 			double t_in_sec;
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 
 namespace viscom {
 
@@ -28,6 +29,19 @@ namespace viscom {
 
         SimpleMeshVertex() : position_(0.0f), normal_(0.0f), texCoords_(0.0f) {}
         SimpleMeshVertex(const glm::vec3& pos, const glm::vec3& normal, const glm::vec2& tex) : position_(pos), normal_(normal), texCoords_(tex) {}
+        SimpleMeshVertex(const glm::vec3& pos, const glm::vec3& normal, const glm::vec2& tex, float) : SimpleMeshVertex(pos, normal, tex) {}
+        /** Positions are stored as they are. */
+        static float GetPositionScale(const Mesh*) { return 1.0f; }
+        /** Attributes at fixed locations, for vertices embedded in a larger struct. */
+        static void SetVertexAttributes(GLint positionLoc, GLint normalLoc, GLint texCoordsLoc, GLsizei stride, size_t offset)
+        {
+            glEnableVertexAttribArray(positionLoc);
+            glEnableVertexAttribArray(normalLoc);
+            glEnableVertexAttribArray(texCoordsLoc);
+            glVertexAttribPointer(positionLoc, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<GLvoid*>(offset + offsetof(SimpleMeshVertex, position_)));
+            glVertexAttribPointer(normalLoc, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<GLvoid*>(offset + offsetof(SimpleMeshVertex, normal_)));
+            glVertexAttribPointer(texCoordsLoc, 2, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<GLvoid*>(offset + offsetof(SimpleMeshVertex, texCoords_)));
+        }
         static void SetVertexAttributes(const GPUProgram* program)
         {
             auto attribLoc = program->getAttributeLocations({ "position", "normal", "texCoords" });
@@ -70,4 +84,71 @@ namespace viscom {
             return vbo;
         }
     };
+
+    /**
+     *  Compact vertex for static meshes (16 instead of 32 bytes): positions as normalized shorts, normals as
+     *  signed normalized 2_10_10_10 and texture coordinates as half floats.
+     *  Positions are divided by GetPositionScale(), a cube around the origin that contains the mesh. One uniform
+     *  scale restores them, so it can be folded into the model matrix (and commutes with rotations).
+     */
+    struct PackedMeshVertex
+    {
+        GLshort position_[4]; // w is padding
+        GLuint normal_;
+        GLushort texCoords_[2];
+
+        PackedMeshVertex() : position_{ 0, 0, 0, 0 }, normal_(0), texCoords_{ 0, 0 } {}
+        PackedMeshVertex(const glm::vec3& pos, const glm::vec3& normal, const glm::vec2& tex, float positionScale)
+        {
+            for (int i = 0; i < 3; ++i) position_[i] = static_cast<GLshort>(glm::packSnorm1x16(pos[i] / positionScale));
+            position_[3] = 0;
+            normal_ = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+            texCoords_[0] = glm::packHalf1x16(tex.x);
+            texCoords_[1] = glm::packHalf1x16(tex.y);
+        }
+
+        /** Half the edge length of the cube around the origin that contains all positions. */
+        static float GetPositionScale(const Mesh* mesh)
+        {
+            float scale = 0.0f;
+            for (const auto& v : mesh->GetVertices()) scale = glm::max(scale, glm::max(glm::abs(v.x), glm::max(glm::abs(v.y), glm::abs(v.z))));
+            return (scale > 0.0f) ? scale : 1.0f;
+        }
+
+        static void SetVertexAttributes(const GPUProgram* program)
+        {
+            auto attribLoc = program->getAttributeLocations({ "position", "normal", "texCoords" });
+            if (attribLoc[0] == -1 || attribLoc[1] == -1 || attribLoc[2] == -1)
+                printf("\nPackedMeshVertex warns you: \"Vertex attribs not found in '%s'.\"\n\n", program->getProgramName());
+            SetVertexAttributes(attribLoc[0], attribLoc[1], attribLoc[2], sizeof(PackedMeshVertex), 0);
+            glVertexAttribDivisor(attribLoc[0], 0);
+            glVertexAttribDivisor(attribLoc[1], 0);
+            glVertexAttribDivisor(attribLoc[2], 0);
+        }
+
+        /** Attributes at fixed locations, for vertices embedded in a larger struct. */
+        static void SetVertexAttributes(GLint positionLoc, GLint normalLoc, GLint texCoordsLoc, GLsizei stride, size_t offset)
+        {
+            glEnableVertexAttribArray(positionLoc);
+            glEnableVertexAttribArray(normalLoc);
+            glEnableVertexAttribArray(texCoordsLoc);
+            glVertexAttribPointer(positionLoc, 3, GL_SHORT, GL_TRUE, stride, reinterpret_cast<GLvoid*>(offset + offsetof(PackedMeshVertex, position_)));
+            glVertexAttribPointer(normalLoc, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, reinterpret_cast<GLvoid*>(offset + offsetof(PackedMeshVertex, normal_)));
+            glVertexAttribPointer(texCoordsLoc, 2, GL_HALF_FLOAT, GL_FALSE, stride, reinterpret_cast<GLvoid*>(offset + offsetof(PackedMeshVertex, texCoords_)));
+        }
+
+        static GLuint CreateVertexBuffer(const Mesh* mesh)
+        {
+            GLuint vbo = 0;
+            glGenBuffers(1, &vbo);
+            float positionScale = GetPositionScale(mesh);
+            std::vector<PackedMeshVertex> bufferMem(mesh->GetVertices().size());
+            for (auto i = 0U; i < mesh->GetVertices().size(); ++i)
+                bufferMem[i] = PackedMeshVertex(mesh->GetVertices()[i], mesh->GetNormals()[i], glm::vec2(mesh->GetTexCoords(0)[i]), positionScale);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBufferData(GL_ARRAY_BUFFER, bufferMem.size() * sizeof(PackedMeshVertex), bufferMem.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            return vbo;
+        }
+    };
 }
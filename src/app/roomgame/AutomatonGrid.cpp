@@ -21,51 +21,12 @@ void AutomatonGrid::setCellularAutomaton(GPUCellularAutomaton* automaton) {
 	automaton_ = automaton;
 }
 
-void AutomatonGrid::onMeshpoolInitialized() {
-	meshpool_->updateUniformEveryFrame("automatonTimeDelta", [&](GLint uloc) {
-		glUniform1f(uloc, automaton_->getTimeDeltaNormalized());
-	});
-	meshpool_->updateUniformEveryFrame("gridTex", [&](GLint uloc) {
-		if (!automaton_->isInitialized()) return;
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, automaton_->getLatestTexture());
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		float borderColor[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-		glUniform1i(uloc, 0);
-	});
-	meshpool_->updateUniformEveryFrame("gridTex_PrevState", [&](GLint uloc) {
-		if (!automaton_->isInitialized()) return;
-		glActiveTexture(GL_TEXTURE0 + 1);
-		glBindTexture(GL_TEXTURE_2D, automaton_->getPreviousTexture());
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		float borderColor[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-		glUniform1i(uloc, 1);
-	});
-	meshpool_->updateUniformEveryFrame("gridDimensions", [&](GLint uloc) {
-		glUniform2f(uloc, getNumColumns()*cell_size_, getNumRows()*cell_size_);
-	});
-	meshpool_->updateUniformEveryFrame("gridTranslation", [&](GLint uloc) {
-		glUniform3f(uloc, translation_.x, translation_.y, translation_.z);
-	});
-	meshpool_->updateUniformEveryFrame("gridCellSize", [&](GLint uloc) {
-		glUniform1f(uloc, cell_size_);
-	});
-}
-
 void AutomatonGrid::buildAt(size_t col, size_t row, GridCell::BuildState state) {
 	// Called on user input
 	GridCell* c = getCellAt(col, row);
 	if (!c) return;
 	MeshInstanceGrid::buildAt(c, state);
-	c->updateHealthPoints(vbo_, GridCell::MAX_HEALTH);
+	c->updateHealthPoints(GridCell::MAX_HEALTH);
 	// Route results to automaton
 	automaton_->updateCell(c, state, c->getHealthPoints());
 }
@@ -79,10 +40,25 @@ void AutomatonGrid::updateCell(GridCell* c, GridCell::BuildState state, int hp)
 		return;
 	}
 	MeshInstanceGrid::buildAt(c, state);
-	c->updateHealthPoints(vbo_, hp); // thinking of dynamic outer influence...
+	c->updateHealthPoints(hp); // thinking of dynamic outer influence...
 	// a fixed-on-cell health is not very practical
 }
 
+void AutomatonGrid::setCellState(GridCell* c, GridCell::BuildState state, int hp) {
+	MeshInstanceGrid::buildAt(c, state);
+	c->updateHealthPoints(hp);
+}
+
+size_t AutomatonGrid::uploadEdits() {
+	size_t num_uploads = MeshInstanceGrid::uploadEdits();
+	if (automaton_) num_uploads += automaton_->commitCellEdits();
+	// Per-frame state of the mesh pool shaders (grid geometry is set by MeshInstanceGrid)
+	if (automaton_ && automaton_->isInitialized())
+		meshpool_->setAutomatonState(automaton_->getLatestTexture(), automaton_->getPreviousTexture(),
+			automaton_->getTimeDeltaNormalized());
+	return num_uploads;
+}
+
 void AutomatonGrid::onTransition() {
 	DelayedUpdate* dup = delayed_update_list_;
 	DelayedUpdate* last = 0;
@@ -108,6 +84,26 @@ void AutomatonGrid::onTransition() {
 	}
 }
 
+void AutomatonGrid::setGpuDrivenOuterInfluence(bool on) {
+	if (meshpool_->isGpuDrivenOuterInfluence() == on) return;
+	// Remove or re-create the instances of the cells that have outer influence now
+	if (on) {
+		forEachCell([&](GridCell* c) {
+			if (c->getBuildState() != GridCell::BuildState::OUTER_INFLUENCE) return;
+			removeInstanceAt(c);
+			c->setMeshInstance(RoomSegmentMesh::InstanceBufferRange());
+		});
+		meshpool_->setGpuDrivenOuterInfluence(true);
+	}
+	else {
+		meshpool_->setGpuDrivenOuterInfluence(false);
+		forEachCell([&](GridCell* c) {
+			if (c->getBuildState() == GridCell::BuildState::OUTER_INFLUENCE)
+				addInstanceAt(c, GridCell::BuildState::OUTER_INFLUENCE);
+		});
+	}
+}
+
 void AutomatonGrid::populateCircleAtLastMousePosition(int radius) {
 	glm::vec2 touchPositionNDC =
 		glm::vec2(last_mouse_position_.x, 1.0 - last_mouse_position_.y)
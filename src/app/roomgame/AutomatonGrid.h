@@ -16,15 +16,20 @@ class AutomatonGrid : public MeshInstanceGrid {
 			wait_count_(wait_count), target_(target), to_(to), next_(0) {}
 	};
 	DelayedUpdate* delayed_update_list_;
+protected:
+	size_t uploadEdits() override;
 public:
 	AutomatonGrid(size_t columns, size_t rows, float height, RoomSegmentMeshPool* meshpool);
 	~AutomatonGrid();
 	void setCellularAutomaton(GPUCellularAutomaton*);
-	void onMeshpoolInitialized() override;
 	void buildAt(size_t col, size_t row, GridCell::BuildState buildState) override;
 	void updateCell(GridCell* c, GridCell::BuildState state, int hp);
+	// Sets a cell without delay (state replicated from the master is already delayed)
+	void setCellState(GridCell* c, GridCell::BuildState state, int hp);
 	void onTransition();
 	void populateCircleAtLastMousePosition(int radius);
+	// Draw outer influence from the automaton texture instead of mesh instances
+	void setGpuDrivenOuterInfluence(bool on);
 };
 
 #endif
\ No newline at end of file
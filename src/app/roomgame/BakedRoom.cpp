@@ -0,0 +1,183 @@
+#include "BakedRoom.h"
+#include <algorithm>
+#include <limits>
+#include "GridCell.h"
+
+// Same rotation as in renderMeshInstance.vert
+static glm::vec2 rotateZ_step90(GLint st, float x, float y) {
+	switch (st) {
+	case GridCell::BuildState::LEFT_UPPER_CORNER:
+	case GridCell::BuildState::WALL_LEFT:
+		return glm::vec2(y, -x);
+	case GridCell::BuildState::RIGHT_UPPER_CORNER:
+	case GridCell::BuildState::WALL_TOP:
+		return glm::vec2(-x, -y);
+	case GridCell::BuildState::RIGHT_LOWER_CORNER:
+	case GridCell::BuildState::WALL_RIGHT:
+		return glm::vec2(-y, x);
+	default:
+		return glm::vec2(x, y);
+	}
+}
+
+void BakedRoom::Vertex::setAttribPointer() {
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glEnableVertexAttribArray(3);
+	glEnableVertexAttribArray(4);
+	glEnableVertexAttribArray(5);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, position_));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, normal_));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, texCoords_));
+	glVertexAttribIPointer(3, 1, GL_INT, sizeof(Vertex), (GLvoid*)offsetof(Vertex, buildState_));
+	glVertexAttribIPointer(4, 1, GL_INT, sizeof(Vertex), (GLvoid*)offsetof(Vertex, health_));
+	glVertexAttribIPointer(5, 4, GL_SHORT, sizeof(Vertex), (GLvoid*)offsetof(Vertex, material_));
+}
+
+BakedRoom::BakedRoom(const std::vector<RoomSegmentMesh::InstanceBufferRange>& ranges, const RoomSegmentMesh::GridGeometry& grid) :
+	ranges_(ranges),
+	grid_(grid),
+	num_indices_(0),
+	num_bakes_(0),
+	released_(false)
+{
+	glGenVertexArrays(1, &vao_);
+	glGenBuffers(1, &vbo_);
+	glGenBuffers(1, &ibo_);
+	glBindVertexArray(vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+	Vertex::setAttribPointer();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	bake();
+	// Edits before baking are already included
+	for (RoomSegmentMesh::InstanceBufferRange& r : ranges_)
+		r.mesh_->takeRoomRangeEdits(r.instance_id_);
+}
+
+BakedRoom::~BakedRoom() {
+	glDeleteBuffers(1, &ibo_);
+	glDeleteBuffers(1, &vbo_);
+	glDeleteVertexArrays(1, &vao_);
+}
+
+int BakedRoom::getHealthLevel(const RoomSegmentMesh::Instance& i) {
+	if (i.isHidden()) return -1; // removed segment
+	int h = std::max(0, std::min((int)i.getHealth(), GridCell::MAX_HEALTH));
+	return h * HEALTH_LEVELS / (GridCell::MAX_HEALTH + 1);
+}
+
+bool BakedRoom::isLevelChanged() {
+	size_t k = 0;
+	for (RoomSegmentMesh::InstanceBufferRange& r : ranges_) {
+		int num_instances = 0;
+		const RoomSegmentMesh::Instance* instances = r.mesh_->getRoomOrderedInstances(r.instance_id_, num_instances);
+		for (int i = 0; i < num_instances; i++, k++)
+			if (k >= baked_levels_.size() || baked_levels_[k] != getHealthLevel(instances[i])) return true;
+	}
+	return k != baked_levels_.size();
+}
+
+void BakedRoom::bake() {
+	std::vector<Vertex> vertices;
+	std::vector<GLuint> indices;
+	baked_levels_.clear();
+	bounds_.minmax[0] = glm::vec3(std::numeric_limits<float>::infinity());
+	bounds_.minmax[1] = glm::vec3(-std::numeric_limits<float>::infinity());
+	for (RoomSegmentMesh::InstanceBufferRange& r : ranges_) {
+		int num_instances = 0;
+		const RoomSegmentMesh::Instance* instances = r.mesh_->getRoomOrderedInstances(r.instance_id_, num_instances);
+		for (int i = 0; i < num_instances; i++)
+			baked_levels_.push_back(getHealthLevel(instances[i]));
+		const viscom::Mesh* mesh = r.mesh_->getMesh();
+		const std::vector<unsigned int>& mesh_indices = mesh->GetIndices();
+		for (size_t d = 0; d < mesh->GetDrawList().size(); d++) {
+			const viscom::Mesh::SubMeshDraw& draw = mesh->GetDrawList()[d];
+			const glm::mat4& localMatrix = draw.localMatrix;
+			glm::ivec4 material = r.mesh_->getSubMeshMaterial(d);
+			auto first = mesh_indices.begin() + draw.indexOffset;
+			auto last = first + draw.numIndices;
+			// Vertices used by the sub mesh and indices into them
+			std::vector<unsigned int> used(first, last);
+			std::sort(used.begin(), used.end());
+			used.erase(std::unique(used.begin(), used.end()), used.end());
+			std::vector<GLuint> local_indices;
+			local_indices.reserve(last - first);
+			for (auto it = first; it != last; it++)
+				local_indices.push_back((GLuint)(std::lower_bound(used.begin(), used.end(), *it) - used.begin()));
+			for (int i = 0; i < num_instances; i++) {
+				const RoomSegmentMesh::Instance& inst = instances[i];
+				if (inst.isHidden()) continue;
+				GLint st = inst.getBuildState();
+				glm::vec3 translation = inst.getTranslation(grid_);
+				GLfloat scale = inst.getScale(grid_);
+				GLuint base = (GLuint)vertices.size();
+				for (unsigned int v : used) {
+					glm::vec3 p = mesh->GetVertices()[v];
+					glm::vec3 n = mesh->GetNormals()[v];
+					glm::vec4 local = localMatrix * glm::vec4(rotateZ_step90(st, p.x, -p.z), p.y, 1);
+					Vertex out;
+					out.position_ = scale * glm::vec3(local) + translation * local.w;
+					bounds_.minmax[0] = glm::min(bounds_.minmax[0], out.position_);
+					bounds_.minmax[1] = glm::max(bounds_.minmax[1], out.position_);
+					out.normal_ = glm::vec3(rotateZ_step90(st, n.x, -n.z), n.y);
+					out.texCoords_ = glm::vec2(mesh->GetTexCoords(0)[v]);
+					out.buildState_ = st;
+					out.health_ = inst.getHealth();
+					for (int c = 0; c < 4; c++) out.material_[c] = (GLshort)material[c];
+					vertices.push_back(out);
+				}
+				for (GLuint idx : local_indices)
+					indices.push_back(base + idx);
+			}
+		}
+	}
+	// Element buffer binding is VAO state
+	glBindVertexArray(vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	num_indices_ = (GLsizei)indices.size();
+	num_bakes_++;
+}
+
+bool BakedRoom::update() {
+	if (released_) return false;
+	bool edited = false;
+	for (RoomSegmentMesh::InstanceBufferRange& r : ranges_)
+		if (r.mesh_->takeRoomRangeEdits(r.instance_id_)) edited = true;
+	// Health changes within a level keep the baked value
+	if (!edited || !isLevelChanged()) return false;
+	bake();
+	return true;
+}
+
+void BakedRoom::render() {
+	if (released_ || num_indices_ == 0) return;
+	glBindVertexArray(vao_);
+	glDrawElements(GL_TRIANGLES, num_indices_, GL_UNSIGNED_INT, (GLvoid*)0);
+}
+
+void BakedRoom::release() {
+	released_ = true;
+}
+
+bool BakedRoom::isReleased() {
+	return released_;
+}
+
+GLsizei BakedRoom::getNumIndices() {
+	return num_indices_;
+}
+
+const viscom::math::AABB3<float>& BakedRoom::getBounds() {
+	return bounds_;
+}
+
+size_t BakedRoom::getNumBakes() {
+	return num_bakes_;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef BAKED_ROOM_H
+#define BAKED_ROOM_H
+
+#include <vector>
+#include "RoomSegmentMesh.h"
+#include "core/math/primitives.h"
+
+/*
+* Static geometry of a finished room.
+* All segment instances of the room are placed and transformed on the CPU (same
+* math as renderMeshInstance.vert) and merged into one vertex and index buffer,
+* so a room is one draw call regardless of its size.
+* Build state and health are stored per vertex for the damage shading, the material
+* layers of the sub mesh for texturing (same as drawn through the pool).
+* The room is re-baked only when a segment's health crosses a level threshold
+* or a segment is removed.
+*/
+class BakedRoom {
+public:
+	struct Vertex {
+		glm::vec3 position_;
+		glm::vec3 normal_;
+		glm::vec2 texCoords_;
+		GLint buildState_;
+		GLint health_;
+		GLshort material_[4]; // layers in the pool's material texture arrays, -1 for none
+		static void setAttribPointer();
+	};
+	// Number of health levels that cause a re-bake
+	static const int HEALTH_LEVELS = 10;
+private:
+	std::vector<RoomSegmentMesh::InstanceBufferRange> ranges_; // one range per mesh
+	std::vector<int> baked_levels_; // health level per instance at the last bake, -1 for hidden
+	RoomSegmentMesh::GridGeometry grid_; // to place the instances
+	GLuint vao_;
+	GLuint vbo_;
+	GLuint ibo_;
+	GLsizei num_indices_;
+	viscom::math::AABB3<float> bounds_; // world space, for culling
+	size_t num_bakes_;
+	bool released_;
+	static int getHealthLevel(const RoomSegmentMesh::Instance& i);
+	bool isLevelChanged();
+	void bake();
+public:
+	BakedRoom(const std::vector<RoomSegmentMesh::InstanceBufferRange>& ranges, const RoomSegmentMesh::GridGeometry& grid);
+	~BakedRoom();
+	BakedRoom(const BakedRoom&) = delete;
+	BakedRoom& operator=(const BakedRoom&) = delete;
+	// Re-bakes if needed, returns true if the buffers were rebuilt
+	bool update();
+	void render();
+	// Room ranges are about to be removed, the pool deletes the room on the next commit
+	void release();
+	bool isReleased();
+	GLsizei getNumIndices();
+	const viscom::math::AABB3<float>& getBounds();
+	size_t getNumBakes();
+};
+
+#endif
\ No newline at end of file
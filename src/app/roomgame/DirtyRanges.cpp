@@ -0,0 +1,44 @@
+#include "DirtyRanges.h"
+#include <algorithm>
+
+DirtyRanges::DirtyRanges(size_t max_gap) {
+	max_gap_ = max_gap;
+}
+
+void DirtyRanges::add(size_t begin, size_t end) {
+	if (begin >= end) return;
+	// Extend the last range if the edit continues it (common for sequential edits)
+	if (!ranges_.empty()) {
+		std::pair<size_t, size_t>& last = ranges_.back();
+		if (begin <= last.second + max_gap_ && end + max_gap_ >= last.first) {
+			last.first = std::min(last.first, begin);
+			last.second = std::max(last.second, end);
+			return;
+		}
+	}
+	ranges_.push_back(std::make_pair(begin, end));
+}
+
+size_t DirtyRanges::flush(const std::function<void(size_t, size_t)>& upload) {
+	if (ranges_.empty()) return 0;
+	std::sort(ranges_.begin(), ranges_.end());
+	size_t num_uploads = 0;
+	std::pair<size_t, size_t> merged = ranges_[0];
+	for (size_t i = 1; i < ranges_.size(); i++) {
+		if (ranges_[i].first <= merged.second + max_gap_) {
+			merged.second = std::max(merged.second, ranges_[i].second);
+			continue;
+		}
+		upload(merged.first, merged.second);
+		num_uploads++;
+		merged = ranges_[i];
+	}
+	upload(merged.first, merged.second);
+	num_uploads++;
+	ranges_.clear();
+	return num_uploads;
+}
+
+void DirtyRanges::clear() {
+	ranges_.clear();
+}
\ No newline at end of file
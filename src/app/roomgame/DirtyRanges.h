@@ -0,0 +1,30 @@
+#ifndef DIRTY_RANGES_H
+#define DIRTY_RANGES_H
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/*
+* Collects modified element ranges of a buffer between two uploads.
+* On flush the ranges are sorted and merged, so that many small edits
+* become a few large uploads. Ranges separated by at most max_gap
+* clean elements are merged too (re-uploading a few clean elements
+* is cheaper than another upload call).
+*/
+class DirtyRanges {
+	std::vector<std::pair<size_t, size_t>> ranges_; // [begin, end)
+	size_t max_gap_;
+public:
+	DirtyRanges(size_t max_gap = 0);
+	void add(size_t begin, size_t end);
+	void add(size_t index) { add(index, index + 1); }
+	bool isEmpty() const { return ranges_.empty(); }
+	// Calls upload(begin, end) once per merged range, then clears all ranges
+	// Returns the number of calls
+	size_t flush(const std::function<void(size_t, size_t)>& upload);
+	void clear();
+};
+
+#endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "GPUCellularAutomaton.h"
+#include <algorithm>
 
 GPUCellularAutomaton::GPUCellularAutomaton(AutomatonGrid* grid, double transition_time) {
 	grid_ = grid;
@@ -8,7 +9,18 @@ GPUCellularAutomaton::GPUCellularAutomaton(AutomatonGrid* grid, double transitio
 	last_time_ = 0.0;
 	delta_time_ = 0.0;
 	is_initialized_ = false;
+	upload_buffer_ = 0;
 	current_read_index_ = 0;
+	readback_latency_ = 1;
+	readback_oldest_ = 0;
+	num_pending_readbacks_ = 0;
+	num_fences_not_signaled_ = 0;
+	num_forced_waits_ = 0;
+	num_dropped_readbacks_ = 0;
+	num_changed_cells_ = 0;
+	num_generations_ = 0;
+	applied_generation_ = 0;
+	replicated_generation_ = 0;
 }
 
 void GPUCellularAutomaton::cleanup() {
@@ -17,7 +29,10 @@ void GPUCellularAutomaton::cleanup() {
 		glDeleteTextures(1, &texture_pair_[1].id);
 		delete framebuffer_pair_[0];
 		delete framebuffer_pair_[1];
-		free(tmp_client_buffer_);
+		deleteReadbackRing();
+		glDeleteVertexArrays(1, &compact_vao_);
+		glDeleteBuffers(1, &edit_vbo_);
+		glDeleteVertexArrays(1, &edit_vao_);
 	}
 }
 
@@ -37,12 +52,31 @@ void GPUCellularAutomaton::init(viscom::GPUProgramManager mgr) {
 	texture_pair_[0].datatype = texture_pair_[1].datatype = GL_UNSIGNED_BYTE;
 	framebuffer_pair_[0] = new GPUBuffer(cols, rows, { &texture_pair_[0] });
 	framebuffer_pair_[1] = new GPUBuffer(cols, rows, { &texture_pair_[1] });
-	// Temporary client buffer to transfer pixels from and to
-	size_t bytes = cols * rows * 2 * sizeof(GLubyte);
-	tmp_client_buffer_ = (GLubyte*)malloc(bytes);
-	if (!tmp_client_buffer_) throw std::runtime_error("");
 	// Get initial state of grid
 	copyFromGridToTexture(0);
+	// Buffers to read changed cells back without stalling
+	compact_shader_ = mgr.GetResource("cellularAutomatonCompact",
+		std::initializer_list<std::string>{ "cellularAutomatonCompact.vert", "cellularAutomatonCompact.geom" },
+		std::vector<std::string>{ "changedCell" });
+	current_grid_uloc_ = compact_shader_->getUniformLocation("currentGrid");
+	previous_grid_uloc_ = compact_shader_->getUniformLocation("previousGrid");
+	grid_columns_uloc_ = compact_shader_->getUniformLocation("gridColumns");
+	glGenVertexArrays(1, &compact_vao_); // no attributes, cells are addressed by gl_VertexID
+	cell_edit_generation_.assign(cols * rows, 0);
+	createReadbackRing();
+	// Point list to write edited cells
+	edit_shader_ = mgr.GetResource("cellularAutomatonEdit",
+		std::initializer_list<std::string>{ "cellularAutomatonEdit.vert", "cellularAutomatonEdit.frag" });
+	edit_grid_columns_uloc_ = edit_shader_->getUniformLocation("gridColumns");
+	edit_pixel_size_uloc_ = edit_shader_->getUniformLocation("pxsize");
+	glGenVertexArrays(1, &edit_vao_);
+	glBindVertexArray(edit_vao_);
+	glGenBuffers(1, &edit_vbo_);
+	glBindBuffer(GL_ARRAY_BUFFER, edit_vbo_);
+	glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, 2 * sizeof(GLuint), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	// Screen filling quad
 	glGenVertexArrays(1, &vao_);
 	glBindVertexArray(vao_);
@@ -68,56 +102,228 @@ void GPUCellularAutomaton::init(viscom::GPUProgramManager mgr) {
 }
 
 void GPUCellularAutomaton::copyFromGridToTexture(int pair_index) {
-	size_t rows = grid_->getNumColumns();
-	size_t cols = grid_->getNumRows();
-	for (unsigned int x = 0; x < cols; x++) {
-		for (unsigned int y = 0; y < rows*2 - 1; y+=2) {
-			GridCell* c = grid_->getCellAt(y/2, x);
-			tmp_client_buffer_[x*2*rows + y] = c->getBuildState();
-			tmp_client_buffer_[x*2*rows + y + 1] = c->getHealthPoints();
-		}
-	}
+	// Grid storage has the same layout as the texture
 	glBindTexture(GL_TEXTURE_2D, texture_pair_[pair_index].id);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)cols, (GLsizei)rows,
-		texture_pair_[pair_index].format, texture_pair_[pair_index].datatype, tmp_client_buffer_);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)grid_->getNumColumns(), (GLsizei)grid_->getNumRows(),
+		texture_pair_[pair_index].format, texture_pair_[pair_index].datatype,
+		grid_->getCellStorage()->getStateHealthData());
 }
 
 void GPUCellularAutomaton::copyFromTextureToGrid(int pair_index) {
-	size_t rows = grid_->getNumColumns();
-	size_t cols = grid_->getNumRows();
-	glBindTexture(GL_TEXTURE_2D, texture_pair_[pair_index].id);
-	glGetTexImage(GL_TEXTURE_2D, 0, texture_pair_[pair_index].format,
-		texture_pair_[pair_index].datatype, tmp_client_buffer_);
-	for (unsigned int x = 0; x < cols; x++) {
-		for (unsigned int y = 0; y < rows*2 - 1; y+=2) {
-			GLubyte state = tmp_client_buffer_[x*2*rows + y];
-			GLubyte hp = tmp_client_buffer_[x*2*rows + y + 1];
-			GridCell* c = grid_->getCellAt(y / 2, x);
-			if (c->getBuildState() == (int)state && c->getHealthPoints() == (int)hp)
-				continue;
+	// Synchronous path: stalls until the GPU has finished the generation
+	requestReadback(pair_index, (pair_index == 0) ? 1 : 0);
+	while (consumeOldestReadback(true));
+}
+
+void GPUCellularAutomaton::copyTexture(int from_pair_index, int to_pair_index) {
+	// Stays on the gpu
+	GLint last_read_fbo, last_draw_fbo;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &last_read_fbo);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &last_draw_fbo);
+	GLint cols = (GLint)grid_->getNumColumns();
+	GLint rows = (GLint)grid_->getNumRows();
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_pair_[from_pair_index]->id());
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer_pair_[to_pair_index]->id());
+	glBlitFramebuffer(0, 0, cols, rows, 0, 0, cols, rows, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)last_read_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)last_draw_fbo);
+}
+
+void GPUCellularAutomaton::applyChangesToGrid(const GLuint* changes, GLuint count, size_t generation) {
+	size_t cols = grid_->getNumColumns();
+	for (GLuint i = 0; i < count; i++) {
+		GLuint index = changes[2 * i];
+		GLubyte state = (GLubyte)(changes[2 * i + 1] & 0xFF);
+		GLubyte hp = (GLubyte)((changes[2 * i + 1] >> 8) & 0xFF);
+		// Cell was edited after this generation was computed
+		if (cell_edit_generation_[index] >= generation) continue;
+		GridCell* c = grid_->getCellAt(index % cols, index / cols);
+		if (c->getBuildState() != (int)state || c->getHealthPoints() != (int)hp)
 			grid_->updateCell(c, (GridCell::BuildState)state, hp);
+	}
+	num_changed_cells_ = count;
+	applied_generation_ = generation;
+}
+
+void GPUCellularAutomaton::createReadbackRing() {
+	readback_ring_.resize((readback_latency_ > 0) ? readback_latency_ : 1);
+	for (ReadbackSlot& slot : readback_ring_) {
+		glGenBuffers(1, &slot.feedback);
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, slot.feedback);
+		glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, getChangeListBytes(), 0, GL_STREAM_READ);
+		glGenQueries(1, &slot.query);
+		slot.fence = 0;
+		slot.generation = 0;
+	}
+	glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+	readback_oldest_ = 0;
+	num_pending_readbacks_ = 0;
+}
+
+void GPUCellularAutomaton::deleteReadbackRing() {
+	for (ReadbackSlot& slot : readback_ring_) {
+		if (slot.fence) glDeleteSync(slot.fence);
+		glDeleteQueries(1, &slot.query);
+		glDeleteBuffers(1, &slot.feedback);
+	}
+	readback_ring_.clear();
+	num_pending_readbacks_ = 0;
+}
+
+void GPUCellularAutomaton::requestReadback(int pair_index, int previous_pair_index) {
+	// Ring full: the oldest generation must be consumed first
+	if (num_pending_readbacks_ == readback_ring_.size()) {
+		num_forced_waits_++;
+		if (!consumeOldestReadback(true)) dropOldestReadback(); // slot is reused below
+	}
+	ReadbackSlot& slot = readback_ring_[(readback_oldest_ + num_pending_readbacks_) % readback_ring_.size()];
+	// Compaction pass: one point per cell, only changed cells survive the geometry shader
+	glUseProgram(compact_shader_->getProgramId());
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture_pair_[pair_index].id);
+	glActiveTexture(GL_TEXTURE0 + 1);
+	glBindTexture(GL_TEXTURE_2D, texture_pair_[previous_pair_index].id);
+	glUniform1i(current_grid_uloc_, 0);
+	glUniform1i(previous_grid_uloc_, 1);
+	glUniform1i(grid_columns_uloc_, (GLint)grid_->getNumColumns());
+	glBindVertexArray(compact_vao_);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, slot.feedback);
+	glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, slot.query);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, (GLsizei)(grid_->getNumColumns() * grid_->getNumRows()));
+	glEndTransformFeedback();
+	glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.generation = ++num_generations_;
+	num_pending_readbacks_++;
+}
+
+bool GPUCellularAutomaton::consumeOldestReadback(bool wait) {
+	if (num_pending_readbacks_ == 0) return false;
+	ReadbackSlot& slot = readback_ring_[readback_oldest_];
+	GLuint64 timeout = wait ? 1000000000 : 0; // nanoseconds
+	GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+	if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+		if (!wait) num_fences_not_signaled_++;
+		return false;
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+	GLuint count = 0;
+	glGetQueryObjectuiv(slot.query, GL_QUERY_RESULT, &count); // available, fence has signaled
+	if (count > 0) {
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, slot.feedback);
+		const GLuint* changes = (const GLuint*)glMapBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER,
+			0, count * 2 * sizeof(GLuint), GL_MAP_READ_BIT);
+		if (changes) {
+			applyChangesToGrid(changes, count, slot.generation);
+			glUnmapBuffer(GL_TRANSFORM_FEEDBACK_BUFFER);
 		}
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+	}
+	else {
+		num_changed_cells_ = 0;
+		applied_generation_ = slot.generation;
 	}
+	readback_oldest_ = (readback_oldest_ + 1) % readback_ring_.size();
+	num_pending_readbacks_--;
+	return true;
+}
+
+void GPUCellularAutomaton::dropOldestReadback() {
+	// GPU did not finish in time: the grid misses the cells that only changed in this generation
+	ReadbackSlot& slot = readback_ring_[readback_oldest_];
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+	num_dropped_readbacks_++;
+	readback_oldest_ = (readback_oldest_ + 1) % readback_ring_.size();
+	num_pending_readbacks_--;
+}
+
+void GPUCellularAutomaton::pollReadbacks() {
+	// Apply all generations the GPU has finished, in order, without blocking
+	while (consumeOldestReadback(false));
+}
+
+bool GPUCellularAutomaton::advanceClock(double time) {
+	delta_time_ = time - last_time_;
+	if (delta_time_ >= transition_time_) {
+		last_time_ = time;
+		delta_time_ = 0;
+		return true;
+	}
+	return false;
+}
+
+size_t GPUCellularAutomaton::getClientBufferBytes() {
+	return grid_->getNumColumns() * grid_->getNumRows() * 2 * sizeof(GLubyte);
+}
+
+size_t GPUCellularAutomaton::getChangeListBytes() {
+	// Worst case: every cell changed
+	return grid_->getNumColumns() * grid_->getNumRows() * 2 * sizeof(GLuint);
 }
 
 void GPUCellularAutomaton::updateCell(GridCell* c, GLint buildState, GLint hp) {
 	if (!is_initialized_) return;
-	GLubyte data[2] = { (GLubyte)buildState, (GLubyte)hp };
-	glBindTexture(GL_TEXTURE_2D, texture_pair_[current_read_index_].id);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)c->getCol(), (GLint)c->getRow(), 1, 1,
-		texture_pair_[0].format, texture_pair_[0].datatype, data);
+	size_t index = c->getRow() * grid_->getNumColumns() + c->getCol();
+	cell_edit_generation_[index] = num_generations_;
+	pending_edits_.push_back((GLuint)index);
+	pending_edits_.push_back((GLuint)(buildState & 0xFF) | ((GLuint)(hp & 0xFF) << 8));
+}
+
+size_t GPUCellularAutomaton::commitCellEdits() {
+	if (!is_initialized_ || pending_edits_.empty()) return 0;
+	GLint last_fbo, last_viewport[4];
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &last_fbo);
+	glGetIntegerv(GL_VIEWPORT, last_viewport);
+	size_t edit_bytes = pending_edits_.size() * sizeof(GLuint);
+	GLintptr offset = upload_buffer_ ? upload_buffer_->stream(pending_edits_.data(), edit_bytes) : -1;
+	glBindVertexArray(edit_vao_);
+	if (offset >= 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, upload_buffer_->getBufferId());
+	}
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, edit_vbo_);
+		glBufferData(GL_ARRAY_BUFFER, edit_bytes, pending_edits_.data(), GL_STREAM_DRAW);
+		offset = 0;
+	}
+	glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, 2 * sizeof(GLuint), (GLvoid*)offset);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// Later points overwrite earlier ones, so the last edit of a cell wins
+	framebuffer_pair_[current_read_index_]->bind();
+	glViewport(0, 0, (GLsizei)grid_->getNumColumns(), (GLsizei)grid_->getNumRows());
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(edit_shader_->getProgramId());
+	glUniform1i(edit_grid_columns_uloc_, (GLint)grid_->getNumColumns());
+	glUniform2f(edit_pixel_size_uloc_, pixel_size_.x, pixel_size_.y);
+	glBindVertexArray(edit_vao_);
+	glDrawArrays(GL_POINTS, 0, (GLsizei)(pending_edits_.size() / 2));
+	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)last_fbo);
+	glViewport(last_viewport[0], last_viewport[1], last_viewport[2], last_viewport[3]);
+	pending_edits_.clear();
+	return 1;
+}
+
+void GPUCellularAutomaton::setUploadBuffer(StreamingBuffer* upload_buffer) {
+	upload_buffer_ = upload_buffer;
 }
 
 void GPUCellularAutomaton::transition(double time) {
 	// Test if simulation can begin
 	if (!is_initialized_) return;
+	pollReadbacks();
 	// Test if it is time for the next generation
-	delta_time_ = time - last_time_;
-	if (delta_time_ >= transition_time_) {
-		last_time_ = time;
-		delta_time_ = 0;
-	}
-	else return;
+	if (!advanceClock(time)) return;
+	commitCellEdits(); // edits belong to the generation that is read now
 	int current_write_index = (current_read_index_ == 0) ? 1 : 0;
 	// Do transition on gpu
 	framebuffer_pair_[current_write_index]->bind();
@@ -139,15 +345,64 @@ void GPUCellularAutomaton::transition(double time) {
 	glEnable(GL_DEPTH_TEST);
 	// Update grid
 	grid_->onTransition();
-	copyFromTextureToGrid(current_write_index); // Performance bottleneck
+	if (readback_latency_ == 0)
+		copyFromTextureToGrid(current_write_index); // Performance bottleneck
+	else
+		requestReadback(current_write_index, current_read_index_); // applied in a later frame
 	// Swap buffers
 	current_read_index_ = current_write_index;
 }
 
+void GPUCellularAutomaton::applyReplicatedState(const GLubyte* state_health, const std::vector<size_t>& changed_cells,
+	size_t generation, double time) {
+	if (!is_initialized_) return;
+	while (consumeOldestReadback(true)); // local generations are outdated
+	pending_edits_.clear(); // replicated state already contains the edits of the master
+	bool is_new_generation = (generation != replicated_generation_);
+	replicated_generation_ = generation;
+	if (is_new_generation) {
+		grid_->onTransition(); // flush delayed updates of the local simulation
+		// New generation starts as a copy of the current one, which is kept for the transition animation
+		int current_write_index = (current_read_index_ == 0) ? 1 : 0;
+		copyTexture(current_read_index_, current_write_index);
+		current_read_index_ = current_write_index;
+		last_time_ = time;
+		delta_time_ = 0;
+	}
+	// Changed cells are written as edits, into the new generation or the current one
+	size_t cols = grid_->getNumColumns();
+	for (size_t index : changed_cells) {
+		GLubyte state = state_health[2 * index];
+		GLubyte hp = state_health[2 * index + 1];
+		GridCell* c = grid_->getCellAt(index % cols, index / cols);
+		if (c->getBuildState() != (int)state || c->getHealthPoints() != (int)hp)
+			grid_->setCellState(c, (GridCell::BuildState)state, hp);
+		pending_edits_.push_back((GLuint)index);
+		pending_edits_.push_back((GLuint)state | ((GLuint)hp << 8));
+	}
+	num_changed_cells_ = changed_cells.size();
+	commitCellEdits();
+}
+
+void GPUCellularAutomaton::advanceReplicatedClock(double time) {
+	// Frames without a message keep fading, until the next generation of the master arrives
+	delta_time_ = std::min(time - last_time_, transition_time_);
+}
+
 void GPUCellularAutomaton::setTransitionTime(double t) {
 	transition_time_ = t;
 }
 
+void GPUCellularAutomaton::setReadbackLatency(size_t generations) {
+	if (generations == readback_latency_) return;
+	readback_latency_ = generations;
+	if (!is_initialized_) return;
+	// Drain generations in flight before the ring is rebuilt
+	while (consumeOldestReadback(true));
+	deleteReadbackRing();
+	createReadbackRing();
+}
+
 GLfloat GPUCellularAutomaton::getTimeDeltaNormalized() {
 	return (GLfloat)(delta_time_ / transition_time_);
 }
@@ -162,4 +417,32 @@ GLuint GPUCellularAutomaton::getPreviousTexture() {
 
 bool GPUCellularAutomaton::isInitialized() {
 	return is_initialized_;
+}
+
+size_t GPUCellularAutomaton::getReadbackLatency() {
+	return readback_latency_;
+}
+
+size_t GPUCellularAutomaton::getNumPendingReadbacks() {
+	return num_pending_readbacks_;
+}
+
+size_t GPUCellularAutomaton::getNumFencesNotSignaled() {
+	return num_fences_not_signaled_;
+}
+
+size_t GPUCellularAutomaton::getNumForcedWaits() {
+	return num_forced_waits_;
+}
+
+size_t GPUCellularAutomaton::getNumDroppedReadbacks() {
+	return num_dropped_readbacks_;
+}
+
+size_t GPUCellularAutomaton::getNumChangedCells() {
+	return num_changed_cells_;
+}
+
+size_t GPUCellularAutomaton::getAppliedGeneration() {
+	return applied_generation_;
 }
\ No newline at end of file
@@ -1,8 +1,10 @@
 #ifndef GPU_CELLULAR_AUTOMATON_H
 #define GPU_CELLULAR_AUTOMATON_H
 
+#include <vector>
 #include "AutomatonGrid.h"
 #include "GPUBuffer.h"
+#include "StreamingBuffer.h"
 
 class GPUCellularAutomaton {
 protected:
@@ -10,7 +12,39 @@ protected:
 	GPUBuffer* framebuffer_pair_[2];
 	GPUBuffer::Tex texture_pair_[2];
 	int current_read_index_;
-	GLubyte* tmp_client_buffer_;
+	// Asynchronous readback (generation N is read while N+1 renders)
+	// Only changed cells are read back, compacted on the gpu by transform feedback
+	struct ReadbackSlot {
+		GLuint feedback; // list of (cell index, state | hp << 8)
+		GLuint query; // number of list entries
+		GLsync fence;
+		size_t generation;
+	};
+	std::vector<ReadbackSlot> readback_ring_;
+	size_t readback_latency_; // max. generations in flight (0 = synchronous)
+	size_t readback_oldest_; // ring index of oldest pending readback
+	size_t num_pending_readbacks_;
+	size_t num_fences_not_signaled_; // polls that found the oldest fence busy
+	size_t num_forced_waits_; // ring was full and CPU had to wait
+	size_t num_dropped_readbacks_; // forced wait timed out, generation was not applied
+	size_t num_changed_cells_; // in the last generation that was applied
+	size_t num_generations_;
+	size_t applied_generation_; // latest generation in the grid (lags the texture by the readback latency)
+	size_t replicated_generation_; // generation of the master that was applied last
+	std::vector<size_t> cell_edit_generation_; // user edits newer than a readback win
+	// Edits are collected and rendered into the texture as points in one draw
+	std::vector<GLuint> pending_edits_; // list of (cell index, state | hp << 8)
+	std::shared_ptr<viscom::GPUProgram> edit_shader_;
+	GLuint edit_vao_;
+	GLuint edit_vbo_; // used when the edits do not fit into the upload buffer
+	StreamingBuffer* upload_buffer_;
+	GLint edit_grid_columns_uloc_;
+	GLint edit_pixel_size_uloc_;
+	std::shared_ptr<viscom::GPUProgram> compact_shader_;
+	GLuint compact_vao_;
+	GLint current_grid_uloc_;
+	GLint previous_grid_uloc_;
+	GLint grid_columns_uloc_;
 	GLuint vao_;
 	std::shared_ptr<viscom::GPUProgram> shader_;
 	GLint pixel_size_uniform_location_;
@@ -23,19 +57,48 @@ protected:
 	// Helper
 	void copyFromGridToTexture(int pair_index);
 	void copyFromTextureToGrid(int pair_index);
+	void copyTexture(int from_pair_index, int to_pair_index);
+	void applyChangesToGrid(const GLuint* changes, GLuint count, size_t generation);
+	void createReadbackRing();
+	void deleteReadbackRing();
+	void requestReadback(int pair_index, int previous_pair_index);
+	bool consumeOldestReadback(bool wait);
+	void dropOldestReadback();
+	void pollReadbacks();
+	bool advanceClock(double time);
+	size_t getClientBufferBytes();
+	size_t getChangeListBytes();
 public:
 	GPUCellularAutomaton(AutomatonGrid* grid, double transition_time);
-	void updateCell(GridCell* c, GLint state, GLint hp);
+	virtual void updateCell(GridCell* c, GLint state, GLint hp);
+	// Writes all edits since the last commit to the texture, returns number of uploads
+	size_t commitCellEdits();
+	// Edits are read by the point draw straight from the upload buffer
+	void setUploadBuffer(StreamingBuffer* upload_buffer);
 	virtual void init(viscom::GPUProgramManager mgr);
 	virtual void transition(double time);
+	// Replaces the local simulation by the state of the master (grid storage layout),
+	// only the given cells are written
+	virtual void applyReplicatedState(const GLubyte* state_health, const std::vector<size_t>& changed_cells,
+		size_t generation, double time);
+	// Replaces transition() on slaves: only the interpolation between generations advances
+	void advanceReplicatedClock(double time);
 	void cleanup();
 	//Setter
 	void setTransitionTime(double);
+	void setReadbackLatency(size_t generations);
 	//Getter
 	GLfloat getTimeDeltaNormalized();
 	GLuint getLatestTexture();
 	GLuint getPreviousTexture();
 	bool isInitialized();
+	size_t getReadbackLatency();
+	size_t getNumPendingReadbacks();
+	size_t getNumFencesNotSignaled();
+	size_t getNumForcedWaits();
+	size_t getNumDroppedReadbacks();
+	size_t getNumChangedCells();
+	size_t getAppliedGeneration();
 };
 
 #endif
\ No newline at end of file
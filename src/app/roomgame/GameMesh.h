@@ -6,6 +6,7 @@
 #include "core/gfx/mesh/Mesh.h"
 #include "core/gfx/GPUProgram.h"
 #include "core/gfx/mesh/MeshRenderable.h"
+#include "core/gfx/mesh/SceneMeshNode.h"
 #include "../Vertices.h"
 
 template <class VERTEX_LAYOUT>
@@ -27,6 +28,15 @@ public:
 	void transform(glm::mat4& t) {
 		model_matrix_ *= t;
 	}
+	// World space bounds (vertex shaders map (x,y,z) to (x,-z,y) before the model matrix)
+	viscom::math::AABB3<float> getBoundingBox() const {
+		glm::mat4 swizzle(1);
+		swizzle[1] = glm::vec4(0, 0, 1, 0);
+		swizzle[2] = glm::vec4(0, -1, 0, 0);
+		viscom::math::AABB3<float> aabb;
+		mesh_resource_->GetRootNode()->GetBoundingBox(aabb, model_matrix_ * swizzle);
+		return aabb;
+	}
 	virtual void render(glm::mat4& vp, GLint isDebugMode = 0) const {
 		glUseProgram(shader_resource_->getProgramId());
 		glUniformMatrix4fv(uloc_view_projection_, 1, GL_FALSE, &vp[0][0]);
@@ -1,165 +1,143 @@
 #include "GridCell.h"
+#include "GridCellStorage.h"
 
-GridCell::GridCell(float x, float y, size_t col_idx, size_t row_idx) {
-	vertex_.x_position = x;
-	vertex_.y_position = y;
-	vertex_.build_state = BuildState::EMPTY;
-	vertex_.health_points = MAX_HEALTH;
-	vertex_buffer_offset_ = 0;
-	northNeighbor = 0, eastNeighbor = 0, southNeighbor = 0, westNeighbor = 0;
-	col_idx_ = col_idx;
-	row_idx_ = row_idx;
+GridCell::GridCell(GridCellStorage* storage) {
+	storage_ = storage;
 }
 
-void GridCell::updateBuildState(GLuint vbo, BuildState s) {
-	vertex_.build_state = s;
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferSubData(GL_ARRAY_BUFFER,
-		vertex_buffer_offset_ + 2 * sizeof(GLfloat),
-		sizeof(vertex_.build_state),
-		(GLvoid*)&vertex_.build_state);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+size_t GridCell::getIndex() {
+	return storage_->getIndex(this);
 }
 
-void GridCell::updateHealthPoints(GLuint vbo, int hp) {
+void GridCell::updateBuildState(BuildState s) {
+	size_t i = getIndex();
+	storage_->setBuildState(i, (GLubyte)s);
+	if (s == BuildState::EMPTY) storage_->removeMeshInstance(i);
+	storage_->markDirty(i); // debug vertex is uploaded on commit
+}
+
+void GridCell::updateHealthPoints(int hp) {
 	if (hp < MIN_HEALTH) hp = MIN_HEALTH;
 	else if (hp > MAX_HEALTH) hp = MAX_HEALTH;
-	vertex_.health_points = hp;
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferSubData(GL_ARRAY_BUFFER,
-		vertex_buffer_offset_ + 2 * sizeof(GLfloat) + sizeof(GLint),
-		sizeof(vertex_.health_points),
-		(GLvoid*)&vertex_.health_points);
-	if (vertex_.build_state != EMPTY) {
-		RoomSegmentMesh::Instance::updateHealth(
-			mesh_instance_.buffer_->id_,
-			mesh_instance_.offset_instances_,
-			vertex_.health_points);
+	size_t i = getIndex();
+	storage_->setHealthPoints(i, (GLubyte)hp);
+	storage_->markDirty(i);
+	if (storage_->getBuildState(i) != EMPTY) {
+		RoomSegmentMesh::InstanceBufferRange mesh_instance = storage_->getMeshInstance(i);
+		if (mesh_instance.mesh_)
+			mesh_instance.mesh_->updateInstanceHealth(mesh_instance, hp);
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void GridCell::setMeshInstance(RoomSegmentMesh::InstanceBufferRange mesh_instance) {
-	mesh_instance_ = mesh_instance;
-}
-
-void GridCell::setVertexBufferOffset(GLintptr o) {
-	vertex_buffer_offset_ = o;
+	storage_->setMeshInstance(getIndex(), mesh_instance);
 }
 
 void GridCell::setVertexAttribPointer() {
 	Vertex::setAttribPointer();
 }
 
-void GridCell::setNorthNeighbor(GridCell* N) {
-	northNeighbor = N;
-}
-
-void GridCell::setEastNeighbor(GridCell* E) {
-	eastNeighbor = E;
-}
-
-void GridCell::setSouthNeighbor(GridCell* S) {
-	southNeighbor = S;
-}
-
-void GridCell::setWestNeighbor(GridCell* W) {
-	westNeighbor = W;
-}
-
 GridCell* GridCell::getNorthNeighbor() {
-	return northNeighbor;
+	return storage_->getCell(getCol(), getRow() + 1);
 }
 
 GridCell* GridCell::getEastNeighbor() {
-	return eastNeighbor;
+	return storage_->getCell(getCol() + 1, getRow());
 }
 
 GridCell* GridCell::getSouthNeighbor() {
-	return southNeighbor;
+	if (getRow() == 0) return 0;
+	return storage_->getCell(getCol(), getRow() - 1);
 }
 
 GridCell* GridCell::getWestNeighbor() {
-	return westNeighbor;
+	if (getCol() == 0) return 0;
+	return storage_->getCell(getCol() - 1, getRow());
 }
 
 glm::vec2 GridCell::getPosition() {
-	return glm::vec2(vertex_.x_position, vertex_.y_position);
+	return storage_->getOrigin() + glm::vec2(getCol(), getRow()) * storage_->getCellSize();
 }
 
 float GridCell::getXPosition() {
-	return vertex_.x_position;
+	return getPosition().x;
 }
 
 float GridCell::getYPosition() {
-	return vertex_.y_position;
+	return getPosition().y;
 }
 
 int GridCell::getBuildState() {
-	return (int)vertex_.build_state;
+	return (int)storage_->getBuildState(getIndex());
 }
 
 int GridCell::getHealthPoints() {
-	return vertex_.health_points;
+	return (int)storage_->getHealthPoints(getIndex());
 }
 
 size_t GridCell::getCol() {
-	return col_idx_;
+	return storage_->getCol(getIndex());
 }
 
 size_t GridCell::getRow() {
-	return row_idx_;
+	return storage_->getRow(getIndex());
 }
 
 GLintptr GridCell::getVertexBufferOffset() {
-	return vertex_buffer_offset_;
+	return (GLintptr)(getIndex() * sizeof(Vertex));
 }
 
 size_t GridCell::getVertexBytes() {
 	return sizeof(Vertex);
 }
 
-void* GridCell::getVertexPointer() {
-	return &vertex_;
+void GridCell::copyVertexTo(void* dst) {
+	Vertex* v = (Vertex*)dst;
+	glm::vec2 pos = getPosition();
+	v->x_position = pos.x;
+	v->y_position = pos.y;
+	v->build_state = getBuildState();
+	v->health_points = getHealthPoints();
 }
 
 bool GridCell::isNorthOf(GridCell* other) {
-	return this->row_idx_ > other->row_idx_;
+	return getRow() > other->getRow();
 }
 
 bool GridCell::isEastOf(GridCell* other) {
-	return this->col_idx_ > other->col_idx_;
+	return getCol() > other->getCol();
 }
 
 bool GridCell::isSouthOf(GridCell* other) {
-	return this->row_idx_ < other->row_idx_;
+	return getRow() < other->getRow();
 }
 
 bool GridCell::isWestOf(GridCell* other) {
-	return this->col_idx_ < other->col_idx_;
+	return getCol() < other->getCol();
 }
 
 size_t GridCell::getColDistanceTo(GridCell* other) {
-	if (other->col_idx_ > this->col_idx_)
-		return other->col_idx_ - this->col_idx_;
+	if (other->getCol() > getCol())
+		return other->getCol() - getCol();
 	else
-		return this->col_idx_ - other->col_idx_;
+		return getCol() - other->getCol();
 }
 
 size_t GridCell::getRowDistanceTo(GridCell* other) {
-	if (other->row_idx_ > this->row_idx_)
-		return other->row_idx_ - this->row_idx_;
+	if (other->getRow() > getRow())
+		return other->getRow() - getRow();
 	else
-		return this->row_idx_ - other->row_idx_;
+		return getRow() - other->getRow();
 }
 
 float GridCell::getDistanceTo(GridCell* other) {
-	return glm::distance(glm::vec2(col_idx_, row_idx_), glm::vec2(other->getCol(), other->getRow()));
+	return glm::distance(glm::vec2(getCol(), getRow()), glm::vec2(other->getCol(), other->getRow()));
 }
 
 RoomSegmentMesh::InstanceBufferRange GridCell::getMeshInstance() {
-	if (vertex_.build_state != BuildState::EMPTY)
-		return mesh_instance_;
+	size_t i = getIndex();
+	if (storage_->getBuildState(i) != BuildState::EMPTY)
+		return storage_->getMeshInstance(i);
 	else
 		return RoomSegmentMesh::InstanceBufferRange();
 }
\ No newline at end of file
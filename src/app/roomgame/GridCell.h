@@ -4,6 +4,9 @@
 #include <sgct/Engine.h>
 #include "RoomSegmentMesh.h"
 
+class GridCellStorage;
+
+// Handle to one cell in a GridCellStorage
 class GridCell {
 public:
 	enum BuildState {
@@ -45,27 +48,17 @@ private:
 			glEnableVertexAttribArray(buildStateAttrLoc);
 			glEnableVertexAttribArray(healthAttrLoc);
 		}
-	} vertex_;
-	GLintptr vertex_buffer_offset_;
-	GridCell* northNeighbor;
-	GridCell* eastNeighbor;
-	GridCell* southNeighbor;
-	GridCell* westNeighbor;
-	size_t col_idx_;
-	size_t row_idx_;
-	RoomSegmentMesh::InstanceBufferRange mesh_instance_;
+	}; // layout of the debug vertex buffer
+	GridCellStorage* storage_; // index is derived from the address of this handle
+	size_t getIndex();
 public:
-	GridCell(float x, float y, size_t col_idx, size_t row_idx);
+	GridCell(GridCellStorage* storage);
 	~GridCell() = default;
-	void updateBuildState(GLuint vbo, BuildState s);
-	void updateHealthPoints(GLuint vbo, int hp);
+	// Edits are recorded in the storage and uploaded by InteractiveGrid::commitEdits
+	void updateBuildState(BuildState s);
+	void updateHealthPoints(int hp);
 	void setMeshInstance(RoomSegmentMesh::InstanceBufferRange mesh_instance);
 	static void setVertexAttribPointer();
-	void setVertexBufferOffset(GLintptr o);
-	void setNorthNeighbor(GridCell* N);
-	void setEastNeighbor(GridCell* E);
-	void setSouthNeighbor(GridCell* S);
-	void setWestNeighbor(GridCell* W);
 	GridCell* getNorthNeighbor();
 	GridCell* getEastNeighbor();
 	GridCell* getSouthNeighbor();
@@ -77,7 +70,7 @@ public:
 	int getHealthPoints();
 	GLintptr getVertexBufferOffset();
 	static size_t getVertexBytes();
-	void* getVertexPointer();
+	void copyVertexTo(void* dst);
 	size_t getCol();
 	size_t getRow();
 	bool isNorthOf(GridCell* other);
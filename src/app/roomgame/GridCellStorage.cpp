@@ -0,0 +1,94 @@
+#include "GridCellStorage.h"
+
+GridCellStorage::GridCellStorage(size_t columns, size_t rows, glm::vec2 origin, float cell_size) :
+	columns_(columns),
+	rows_(rows),
+	origin_(origin),
+	cell_size_(cell_size),
+	dirty_cells_(16),
+	words_per_row_((columns + 63) / 64),
+	words_per_column_((rows + 63) / 64)
+{
+	row_occupancy_.assign(rows * words_per_row_, 0);
+	column_occupancy_.assign(columns * words_per_column_, 0);
+	state_health_.resize(columns * rows * 2);
+	for (size_t i = 0; i < columns * rows; i++) {
+		state_health_[2 * i] = GridCell::BuildState::EMPTY;
+		state_health_[2 * i + 1] = GridCell::MAX_HEALTH;
+	}
+	cells_.reserve(columns * rows); // handles must not move
+	for (size_t i = 0; i < columns * rows; i++)
+		cells_.push_back(GridCell(this));
+}
+
+void GridCellStorage::setOccupied(size_t index, bool occupied) {
+	size_t col = getCol(index);
+	size_t row = getRow(index);
+	uint64_t& row_word = row_occupancy_[row * words_per_row_ + col / 64];
+	uint64_t& column_word = column_occupancy_[col * words_per_column_ + row / 64];
+	uint64_t row_bit = (uint64_t)1 << (col % 64);
+	uint64_t column_bit = (uint64_t)1 << (row % 64);
+	if (occupied) {
+		row_word |= row_bit;
+		column_word |= column_bit;
+	}
+	else {
+		row_word &= ~row_bit;
+		column_word &= ~column_bit;
+	}
+}
+
+bool GridCellStorage::isSpanEmpty(const uint64_t* words, size_t begin, size_t end) {
+	if (begin >= end) return true;
+	size_t first = begin / 64;
+	size_t last = (end - 1) / 64;
+	uint64_t first_mask = ~(uint64_t)0 << (begin % 64);
+	uint64_t last_mask = ~(uint64_t)0 >> (63 - (end - 1) % 64);
+	if (first == last) return (words[first] & first_mask & last_mask) == 0;
+	if (words[first] & first_mask) return false;
+	for (size_t w = first + 1; w < last; w++)
+		if (words[w]) return false;
+	return (words[last] & last_mask) == 0;
+}
+
+bool GridCellStorage::isRowEmpty(size_t row, size_t col_begin, size_t col_end) const {
+	return isSpanEmpty(&row_occupancy_[row * words_per_row_], col_begin, col_end);
+}
+
+bool GridCellStorage::isColumnEmpty(size_t col, size_t row_begin, size_t row_end) const {
+	return isSpanEmpty(&column_occupancy_[col * words_per_column_], row_begin, row_end);
+}
+
+bool GridCellStorage::isRectEmpty(size_t col_begin, size_t col_end, size_t row_begin, size_t row_end) const {
+	// Scan along the shorter side
+	if (col_end - col_begin < row_end - row_begin) {
+		for (size_t col = col_begin; col < col_end; col++)
+			if (!isColumnEmpty(col, row_begin, row_end)) return false;
+	}
+	else {
+		for (size_t row = row_begin; row < row_end; row++)
+			if (!isRowEmpty(row, col_begin, col_end)) return false;
+	}
+	return true;
+}
+
+void GridCellStorage::setMeshInstance(size_t index, RoomSegmentMesh::InstanceBufferRange r) {
+	mesh_instances_[index] = r;
+}
+
+void GridCellStorage::removeMeshInstance(size_t index) {
+	mesh_instances_.erase(index);
+}
+
+RoomSegmentMesh::InstanceBufferRange GridCellStorage::getMeshInstance(size_t index) {
+	auto it = mesh_instances_.find(index);
+	if (it == mesh_instances_.end()) return RoomSegmentMesh::InstanceBufferRange();
+	return it->second;
+}
+
+size_t GridCellStorage::getMemoryBytes() const {
+	return state_health_.capacity() * sizeof(GLubyte)
+		+ cells_.capacity() * sizeof(GridCell)
+		+ mesh_instances_.size() * (sizeof(size_t) + sizeof(RoomSegmentMesh::InstanceBufferRange))
+		+ (row_occupancy_.capacity() + column_occupancy_.capacity()) * sizeof(uint64_t);
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef GRID_CELL_STORAGE_H
+#define GRID_CELL_STORAGE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "GridCell.h"
+#include "DirtyRanges.h"
+
+/*
+* Contiguous storage of all grid cells.
+* Build state and health are kept as one byte each, interleaved per cell
+* in the same layout as the RG8 automaton texture (row after row),
+* so that uploads and downloads are a single copy.
+* Mesh instances are kept in a side table for built cells only.
+* GridCell objects are handles into this storage; neighbors and positions
+* are derived from the cell index.
+* Edited cells are tracked, so the grid can upload them in one commit per frame.
+* Occupancy (build state != EMPTY) is kept as bitsets per row and per column,
+* so emptiness of a row or column span is tested 64 cells at a time.
+*/
+class GridCellStorage {
+	size_t columns_;
+	size_t rows_;
+	glm::vec2 origin_; // position of cell (0,0)
+	float cell_size_;
+	std::vector<GLubyte> state_health_;
+	std::unordered_map<size_t, RoomSegmentMesh::InstanceBufferRange> mesh_instances_;
+	std::vector<GridCell> cells_;
+	DirtyRanges dirty_cells_; // cells edited since the last commit
+	size_t words_per_row_;
+	size_t words_per_column_;
+	std::vector<uint64_t> row_occupancy_; // bit col of row
+	std::vector<uint64_t> column_occupancy_; // bit row of column
+	void setOccupied(size_t index, bool occupied);
+	static bool isSpanEmpty(const uint64_t* words, size_t begin, size_t end);
+public:
+	GridCellStorage(size_t columns, size_t rows, glm::vec2 origin, float cell_size);
+	GridCellStorage(const GridCellStorage&) = delete; // cells point to their storage
+	GridCellStorage& operator=(const GridCellStorage&) = delete;
+	// Cell access
+	GridCell* getCell(size_t col, size_t row) {
+		if (col >= columns_ || row >= rows_) return 0;
+		return &cells_[row * columns_ + col];
+	}
+	GridCell* getCell(size_t index) { return &cells_[index]; }
+	size_t getIndex(const GridCell* c) const { return (size_t)(c - cells_.data()); }
+	size_t getIndex(size_t col, size_t row) const { return row * columns_ + col; }
+	size_t getCol(size_t index) const { return index % columns_; }
+	size_t getRow(size_t index) const { return index / columns_; }
+	// Cell data
+	GLubyte getBuildState(size_t index) const { return state_health_[2 * index]; }
+	GLubyte getHealthPoints(size_t index) const { return state_health_[2 * index + 1]; }
+	void setBuildState(size_t index, GLubyte s) {
+		state_health_[2 * index] = s;
+		setOccupied(index, s != GridCell::BuildState::EMPTY);
+	}
+	void setHealthPoints(size_t index, GLubyte hp) { state_health_[2 * index + 1] = hp; }
+	void setMeshInstance(size_t index, RoomSegmentMesh::InstanceBufferRange r);
+	void removeMeshInstance(size_t index);
+	RoomSegmentMesh::InstanceBufferRange getMeshInstance(size_t index);
+	// Occupancy queries, end is exclusive, ranges must be inside the grid
+	bool isRowEmpty(size_t row, size_t col_begin, size_t col_end) const;
+	bool isColumnEmpty(size_t col, size_t row_begin, size_t row_end) const;
+	bool isRectEmpty(size_t col_begin, size_t col_end, size_t row_begin, size_t row_end) const;
+	// Edit tracking
+	void markDirty(size_t index) { dirty_cells_.add(index); }
+	DirtyRanges& getDirtyCells() { return dirty_cells_; }
+	// Raw (state, health) pairs for all cells
+	const GLubyte* getStateHealthData() const { return state_health_.data(); }
+	size_t getStateHealthBytes() const { return state_health_.size(); }
+	// Getters
+	size_t getNumColumns() const { return columns_; }
+	size_t getNumRows() const { return rows_; }
+	size_t getNumCells() const { return cells_.size(); }
+	glm::vec2 getOrigin() const { return origin_; }
+	float getCellSize() const { return cell_size_; }
+	size_t getMemoryBytes() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,182 @@
+#include "GridStateReplication.h"
+
+GridStateReplication::GridStateReplication(float snapshot_ratio, size_t snapshot_interval) :
+	generation_(0),
+	needs_snapshot_(true),
+	snapshot_ratio_(snapshot_ratio),
+	snapshot_interval_(snapshot_interval),
+	messages_since_snapshot_(0),
+	bytes_last_message_(0),
+	total_bytes_(0),
+	num_deltas_(0),
+	num_snapshots_(0)
+{
+}
+
+void GridStateReplication::writeVarint(std::vector<GLubyte>& out, size_t v) {
+	// 7 bits per byte, high bit set on all but the last byte
+	while (v >= 0x80) {
+		out.push_back((GLubyte)(v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	out.push_back((GLubyte)v);
+}
+
+bool GridStateReplication::readVarint(const std::vector<GLubyte>& in, size_t& pos, size_t& v) {
+	v = 0;
+	for (unsigned int shift = 0; pos < in.size() && shift < 8 * sizeof(size_t); shift += 7) {
+		GLubyte b = in[pos++];
+		v |= (size_t)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+void GridStateReplication::writeHeader(std::vector<GLubyte>& message, MessageType type, size_t generation, size_t bytes) {
+	message.push_back((GLubyte)type);
+	writeVarint(message, generation);
+	writeVarint(message, bytes);
+}
+
+void GridStateReplication::encode(const GLubyte* state, size_t bytes, size_t generation, std::vector<GLubyte>& message) {
+	message.clear();
+	// Lets slaves that dropped a message catch up
+	if (snapshot_interval_ > 0 && messages_since_snapshot_ >= snapshot_interval_) needs_snapshot_ = true;
+	if (!needs_snapshot_ && state_.size() == bytes) {
+		// Runs end at two unchanged bytes in a row (a cell whose health changed is one changed byte)
+		delta_.clear();
+		size_t max_delta_bytes = (size_t)(snapshot_ratio_ * bytes);
+		size_t i = 0;
+		while (i < bytes && delta_.size() <= max_delta_bytes) {
+			size_t unchanged = 0;
+			while (i + unchanged < bytes && state[i + unchanged] == state_[i + unchanged]) unchanged++;
+			if (i + unchanged == bytes) break;
+			i += unchanged;
+			size_t changed = 1;
+			while (i + changed < bytes && (state[i + changed] != state_[i + changed]
+				|| (i + changed + 1 < bytes && state[i + changed + 1] != state_[i + changed + 1]))) changed++;
+			writeVarint(delta_, unchanged);
+			writeVarint(delta_, changed);
+			for (size_t k = i; k < i + changed; k++) delta_.push_back(state[k] ^ state_[k]);
+			i += changed;
+		}
+		if (delta_.empty() && generation == generation_) {
+			bytes_last_message_ = 0;
+			return;
+		}
+		if (delta_.size() <= max_delta_bytes) {
+			writeHeader(message, DELTA, generation, bytes);
+			message.insert(message.end(), delta_.begin(), delta_.end());
+			num_deltas_++;
+		}
+	}
+	if (message.empty()) {
+		writeHeader(message, SNAPSHOT, generation, bytes);
+		message.insert(message.end(), state, state + bytes);
+		num_snapshots_++;
+		needs_snapshot_ = false;
+		messages_since_snapshot_ = 0;
+	}
+	else messages_since_snapshot_++;
+	state_.assign(state, state + bytes);
+	generation_ = generation;
+	bytes_last_message_ = message.size();
+	total_bytes_ += message.size();
+}
+
+bool GridStateReplication::decode(const std::vector<GLubyte>& message) {
+	bytes_last_message_ = message.size();
+	changed_cells_.clear();
+	if (message.empty()) return false;
+	total_bytes_ += message.size();
+	size_t pos = 1;
+	size_t generation, bytes;
+	if (!readVarint(message, pos, generation) || !readVarint(message, pos, bytes)) {
+		state_.clear(); // ignore deltas until the next snapshot
+		return false;
+	}
+	if (message[0] == SNAPSHOT) {
+		if (message.size() - pos != bytes) {
+			state_.clear();
+			return false;
+		}
+		const GLubyte* snapshot = &message[pos];
+		for (size_t cell = 0; 2 * cell < bytes; cell++) {
+			size_t b = 2 * cell;
+			if (state_.size() != bytes || state_[b] != snapshot[b] || state_[b + 1] != snapshot[b + 1])
+				changed_cells_.push_back(cell);
+		}
+		state_.assign(message.begin() + pos, message.end());
+		num_snapshots_++;
+	}
+	else if (message[0] == DELTA) {
+		if (state_.size() != bytes) { // no snapshot received yet, or a message was dropped
+			state_.clear();
+			return false;
+		}
+		runs_.clear();
+		size_t i = 0;
+		while (pos < message.size()) {
+			size_t unchanged, changed;
+			if (!readVarint(message, pos, unchanged) || !readVarint(message, pos, changed)
+				|| unchanged > bytes - i || changed > bytes - i - unchanged || changed > message.size() - pos) {
+				state_.clear(); // a partly applied delta would diverge for good
+				return false;
+			}
+			i += unchanged;
+			runs_.push_back({ i, pos, changed });
+			i += changed;
+			pos += changed;
+		}
+		// Message is valid, apply it
+		for (const Run& run : runs_) {
+			for (size_t k = 0; k < run.length; k++) {
+				GLubyte x = message[run.pos + k];
+				if (x == 0) continue; // bridged unchanged byte
+				state_[run.offset + k] ^= x;
+				size_t cell = (run.offset + k) / 2;
+				if (changed_cells_.empty() || changed_cells_.back() != cell) changed_cells_.push_back(cell);
+			}
+		}
+		num_deltas_++;
+	}
+	else {
+		state_.clear();
+		return false;
+	}
+	generation_ = generation;
+	return true;
+}
+
+void GridStateReplication::reset() {
+	needs_snapshot_ = true;
+	state_.clear(); // slaves ignore deltas until the next snapshot
+}
+
+const std::vector<GLubyte>& GridStateReplication::getState() {
+	return state_;
+}
+
+const std::vector<size_t>& GridStateReplication::getChangedCells() {
+	return changed_cells_;
+}
+
+size_t GridStateReplication::getGeneration() {
+	return generation_;
+}
+
+size_t GridStateReplication::getBytesLastMessage() {
+	return bytes_last_message_;
+}
+
+size_t GridStateReplication::getTotalBytes() {
+	return total_bytes_;
+}
+
+size_t GridStateReplication::getNumDeltas() {
+	return num_deltas_;
+}
+
+size_t GridStateReplication::getNumSnapshots() {
+	return num_snapshots_;
+}
\ No newline at end of file
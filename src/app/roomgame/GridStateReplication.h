@@ -0,0 +1,68 @@
+#ifndef GRID_STATE_REPLICATION_H
+#define GRID_STATE_REPLICATION_H
+
+#include <vector>
+#include <sgct/Engine.h>
+
+/*
+* Replicates the grid state (build state and health per cell, same layout
+* as the automaton texture) from the master to the slaves, so only the
+* master simulates.
+* A message holds the bytes that changed since the last message: runs of
+* unchanged and changed bytes as varint lengths, changed bytes XOR-ed with
+* the previous state. The first message and deltas larger than a part of
+* the state are sent as full snapshot instead.
+* Slaves cannot answer the master, so a snapshot is also sent every
+* snapshot_interval messages. A slave that could not apply a message drops
+* its state and waits for that snapshot instead of diverging.
+*/
+class GridStateReplication {
+public:
+	enum MessageType {
+		DELTA = 1, SNAPSHOT = 2
+	};
+private:
+	std::vector<GLubyte> state_; // last sent (master) or received (slave)
+	size_t generation_; // automaton generation of the state
+	bool needs_snapshot_;
+	float snapshot_ratio_;
+	size_t snapshot_interval_;
+	size_t messages_since_snapshot_;
+	std::vector<GLubyte> delta_; // reused encoding buffer
+	std::vector<size_t> changed_cells_; // by the last decoded message, ascending
+	struct Run {
+		size_t offset; // in the state
+		size_t pos; // of the XOR-ed bytes in the message
+		size_t length;
+	};
+	std::vector<Run> runs_; // delta is parsed completely before it is applied
+	size_t bytes_last_message_;
+	size_t total_bytes_;
+	size_t num_deltas_;
+	size_t num_snapshots_;
+	static void writeVarint(std::vector<GLubyte>& out, size_t v);
+	static bool readVarint(const std::vector<GLubyte>& in, size_t& pos, size_t& v);
+	void writeHeader(std::vector<GLubyte>& message, MessageType type, size_t generation, size_t bytes);
+public:
+	// Deltas larger than snapshot_ratio of the state are sent as snapshot,
+	// every snapshot_interval messages a snapshot is sent anyway (0 = never)
+	GridStateReplication(float snapshot_ratio = 0.25f, size_t snapshot_interval = 300);
+	// Master: message with the changes since the last message (empty if there are none)
+	void encode(const GLubyte* state, size_t bytes, size_t generation, std::vector<GLubyte>& message);
+	// Slave: applies a message to the received state, returns false if it was empty or could not be applied
+	// (the state is left unchanged by an empty message and dropped otherwise)
+	bool decode(const std::vector<GLubyte>& message);
+	// Next message must be a snapshot (replication was switched off meanwhile)
+	void reset();
+	const std::vector<GLubyte>& getState();
+	// Cells the last decoded message changed (all cells for the first snapshot)
+	const std::vector<size_t>& getChangedCells();
+	size_t getGeneration();
+	// Bandwidth (sent on the master, received on the slaves)
+	size_t getBytesLastMessage();
+	size_t getTotalBytes();
+	size_t getNumDeltas();
+	size_t getNumSnapshots();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include "GridTileTree.h"
+#include <algorithm>
+
+namespace {
+	// AABBInFrustumTest only tells inside or intersecting, a box is inside if its most negative corner is
+	bool isAABBInsideFrustum(const viscom::math::Frustum<float>& f, const viscom::math::AABB3<float>& b) {
+		for (unsigned int i = 0; i < 6; ++i) {
+			glm::vec3 n{ b.minmax[1] };
+			if (f.planes[i].x >= 0) n.x = b.minmax[0].x;
+			if (f.planes[i].y >= 0) n.y = b.minmax[0].y;
+			if (f.planes[i].z >= 0) n.z = b.minmax[0].z;
+			if ((glm::dot(glm::vec3(f.planes[i]), n) + f.planes[i].w) < 0) return false;
+		}
+		return true;
+	}
+}
+
+GridTileTree::GridTileTree() :
+	columns_(0),
+	rows_(0),
+	tile_columns_(0),
+	tile_rows_(0),
+	cell_step_(0),
+	num_visible_tiles_(0),
+	num_tested_nodes_(0),
+	visible_tile_rect_(0)
+{
+}
+
+void GridTileTree::build(size_t columns, size_t rows, const viscom::math::AABB3<float>& first_cell, glm::vec2 cell_step) {
+	columns_ = columns;
+	rows_ = rows;
+	tile_columns_ = (columns + TILE_CELLS - 1) / TILE_CELLS;
+	tile_rows_ = (rows + TILE_CELLS - 1) / TILE_CELLS;
+	first_cell_ = first_cell;
+	cell_step_ = cell_step;
+	nodes_.clear();
+	if (tile_columns_ > 0 && tile_rows_ > 0)
+		buildNode(glm::ivec4(0, 0, tile_columns_, tile_rows_));
+	// Nothing culled until the first test
+	visible_tiles_.resize(tile_columns_ * tile_rows_);
+	setAllVisible();
+}
+
+int GridTileTree::buildNode(glm::ivec4 tiles) {
+	int index = (int)nodes_.size();
+	nodes_.push_back(Node());
+	// Bounds of the cells in the tiles (the last tiles can be partial)
+	int first_col = tiles.x * (int)TILE_CELLS;
+	int first_row = tiles.y * (int)TILE_CELLS;
+	int last_col = std::min((tiles.x + tiles.z) * (int)TILE_CELLS, (int)columns_) - 1;
+	int last_row = std::min((tiles.y + tiles.w) * (int)TILE_CELLS, (int)rows_) - 1;
+	glm::vec3 first_offset(glm::vec2(first_col, first_row) * cell_step_, 0.0f);
+	glm::vec3 last_offset(glm::vec2(last_col, last_row) * cell_step_, 0.0f);
+	viscom::math::AABB3<float> bounds;
+	bounds.minmax[0] = glm::min(first_cell_.minmax[0] + first_offset, first_cell_.minmax[0] + last_offset);
+	bounds.minmax[1] = glm::max(first_cell_.minmax[1] + first_offset, first_cell_.minmax[1] + last_offset);
+	int children[4] = { -1, -1, -1, -1 };
+	if (tiles.z > 1 || tiles.w > 1) {
+		// Split both axes in halves (an axis of one tile is not split)
+		int left = (tiles.z + 1) / 2;
+		int bottom = (tiles.w + 1) / 2;
+		int num_children = 0;
+		for (int y = 0; y < 2; y++) {
+			for (int x = 0; x < 2; x++) {
+				glm::ivec4 child(tiles.x + x * left, tiles.y + y * bottom,
+					(x == 0) ? left : tiles.z - left, (y == 0) ? bottom : tiles.w - bottom);
+				if (child.z <= 0 || child.w <= 0) continue;
+				children[num_children++] = buildNode(child);
+			}
+		}
+	}
+	Node& node = nodes_[index]; // after the recursion, which can reallocate
+	node.bounds = bounds;
+	node.tiles = tiles;
+	for (int i = 0; i < 4; i++) node.children[i] = children[i];
+	return index;
+}
+
+void GridTileTree::setAllVisible() {
+	std::fill(visible_tiles_.begin(), visible_tiles_.end(), (GLubyte)1);
+	num_visible_tiles_ = visible_tiles_.size();
+	num_tested_nodes_ = 0;
+	visible_tile_rect_ = glm::ivec4(0, 0, (int)tile_columns_, (int)tile_rows_);
+}
+
+bool GridTileTree::isBuilt() {
+	return !nodes_.empty();
+}
+
+void GridTileTree::cull(const viscom::math::Frustum<float>& frustum) {
+	std::fill(visible_tiles_.begin(), visible_tiles_.end(), (GLubyte)0);
+	num_visible_tiles_ = 0;
+	num_tested_nodes_ = 0;
+	visible_tile_rect_ = glm::ivec4((int)tile_columns_, (int)tile_rows_, 0, 0); // min and max corner while culling
+	if (!nodes_.empty()) cullNode(0, frustum);
+	if (num_visible_tiles_ == 0) visible_tile_rect_ = glm::ivec4(0);
+	else visible_tile_rect_ = glm::ivec4(visible_tile_rect_.x, visible_tile_rect_.y,
+		visible_tile_rect_.z - visible_tile_rect_.x, visible_tile_rect_.w - visible_tile_rect_.y);
+}
+
+void GridTileTree::cullNode(int index, const viscom::math::Frustum<float>& frustum) {
+	const Node& node = nodes_[index];
+	num_tested_nodes_++;
+	if (!viscom::math::AABBInFrustumTest(frustum, node.bounds)) return;
+	if (node.children[0] < 0 || isAABBInsideFrustum(frustum, node.bounds)) {
+		markVisible(node.tiles);
+		return;
+	}
+	for (int i = 0; i < 4 && node.children[i] >= 0; i++)
+		cullNode(node.children[i], frustum);
+}
+
+void GridTileTree::markVisible(glm::ivec4 tiles) {
+	for (int y = tiles.y; y < tiles.y + tiles.w; y++)
+		for (int x = tiles.x; x < tiles.x + tiles.z; x++)
+			visible_tiles_[y * tile_columns_ + x] = 1;
+	num_visible_tiles_ += tiles.z * tiles.w;
+	visible_tile_rect_.x = std::min(visible_tile_rect_.x, tiles.x);
+	visible_tile_rect_.y = std::min(visible_tile_rect_.y, tiles.y);
+	visible_tile_rect_.z = std::max(visible_tile_rect_.z, tiles.x + tiles.z);
+	visible_tile_rect_.w = std::max(visible_tile_rect_.w, tiles.y + tiles.w);
+}
+
+bool GridTileTree::isCellVisible(size_t cell_index) {
+	if (columns_ == 0) return true;
+	size_t col = cell_index % columns_;
+	size_t row = cell_index / columns_;
+	if (row >= rows_) return false;
+	return visible_tiles_[(row / TILE_CELLS) * tile_columns_ + col / TILE_CELLS] != 0;
+}
+
+bool GridTileTree::isTileVisible(size_t tile_index) {
+	return visible_tiles_[tile_index] != 0;
+}
+
+bool GridTileTree::isAllVisible() {
+	return num_visible_tiles_ == visible_tiles_.size();
+}
+
+glm::ivec4 GridTileTree::getVisibleTileRect() {
+	return visible_tile_rect_;
+}
+
+glm::ivec4 GridTileTree::getVisibleCellRect() {
+	glm::ivec4 cells = visible_tile_rect_ * (int)TILE_CELLS;
+	// Clamp partial tiles at the far edges
+	cells.z = std::min(cells.z, (int)columns_ - cells.x);
+	cells.w = std::min(cells.w, (int)rows_ - cells.y);
+	return cells;
+}
+
+size_t GridTileTree::getNumTiles() {
+	return visible_tiles_.size();
+}
+
+size_t GridTileTree::getTileColumns() {
+	return tile_columns_;
+}
+
+size_t GridTileTree::getNumVisibleTiles() {
+	return num_visible_tiles_;
+}
+
+size_t GridTileTree::getNumTestedNodes() {
+	return num_tested_nodes_;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef GRID_TILE_TREE_H
+#define GRID_TILE_TREE_H
+
+#include <vector>
+#include <sgct/Engine.h>
+#include "core/math/math.h"
+
+/*
+* Quadtree of cell tiles over the grid, for view frustum culling.
+* Leaves are tiles of TILE_CELLS x TILE_CELLS cells, inner nodes bound their
+* children. A node inside the frustum makes its subtree visible without
+* further tests, a node outside culls it.
+* Each projector sees a part of the wall, so most of the tree is culled
+* near the root.
+*/
+class GridTileTree {
+public:
+	static const size_t TILE_CELLS = 8;
+private:
+	struct Node {
+		viscom::math::AABB3<float> bounds;
+		glm::ivec4 tiles; // first tile column, first tile row, tile columns, tile rows
+		int children[4]; // -1 for none
+	};
+	std::vector<Node> nodes_; // root first
+	size_t columns_;
+	size_t rows_;
+	size_t tile_columns_;
+	size_t tile_rows_;
+	viscom::math::AABB3<float> first_cell_;
+	glm::vec2 cell_step_;
+	std::vector<GLubyte> visible_tiles_;
+	size_t num_visible_tiles_;
+	size_t num_tested_nodes_;
+	glm::ivec4 visible_tile_rect_; // bounding rect of the visible tiles, as in Node::tiles
+	int buildNode(glm::ivec4 tiles);
+	void cullNode(int index, const viscom::math::Frustum<float>& frustum);
+	void markVisible(glm::ivec4 tiles);
+public:
+	GridTileTree();
+	// Cell (col, row) is bounded by first_cell moved by (col, row) * cell_step
+	void build(size_t columns, size_t rows, const viscom::math::AABB3<float>& first_cell, glm::vec2 cell_step);
+	bool isBuilt();
+	void cull(const viscom::math::Frustum<float>& frustum);
+	// All tiles visible without tests (culling disabled)
+	void setAllVisible();
+	bool isCellVisible(size_t cell_index);
+	bool isTileVisible(size_t tile_index);
+	bool isAllVisible();
+	// Bounding rect of the visible tiles: first tile column, first tile row, tile columns, tile rows
+	glm::ivec4 getVisibleTileRect();
+	// First column, first row, columns, rows of the cells of all visible tiles
+	glm::ivec4 getVisibleCellRect();
+	size_t getNumTiles();
+	size_t getTileColumns();
+	size_t getNumVisibleTiles();
+	size_t getNumTestedNodes();
+};
+
+#endif
\ No newline at end of file
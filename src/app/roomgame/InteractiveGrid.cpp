@@ -1,29 +1,21 @@
 #include "InteractiveGrid.h"
+#include <algorithm>
 
 
-InteractiveGrid::InteractiveGrid(size_t columns, size_t rows, float height) {
-	height_units_ = height;
-	cell_size_ = height_units_ / float(rows);
-	for (int x = 0; x < columns; x++) {
-		std::vector<GridCell> column;
-		for (int y = 0; y < rows; y++) {
-			GridCell current(-1.0f + x * cell_size_, -1.0f + y * cell_size_, x, y);
-			column.push_back(current);
-		}
-		cells_.push_back(column);
-	}
-	for (int x = 0; x < columns; x++) {
-		for (int y = 0; y < rows; y++) {
-			cells_[x][y].setNorthNeighbor((y == rows - 1) ? 0 : &cells_[x][y + 1]);
-			cells_[x][y].setEastNeighbor((x == columns - 1) ? 0 : &cells_[x + 1][y]);
-			cells_[x][y].setSouthNeighbor((y == 0) ? 0 : &cells_[x][y - 1]);
-			cells_[x][y].setWestNeighbor((x == 0) ? 0 : &cells_[x - 1][y]);
-		}
-	}
+InteractiveGrid::InteractiveGrid(size_t columns, size_t rows, float height) :
+	height_units_(height),
+	cell_size_(height / float(rows)),
+	cells_(columns, rows, glm::vec2(-1.0f, -1.0f), height / float(rows))
+{
+	vao_ = 0;
+	vbo_ = 0;
 	mvp_uniform_location_ = -1;
 	translation_ = glm::vec3(0);
 	num_vertices_ = 0;
 	last_view_projection_ = glm::mat4(1);
+	inverse_view_projection_ = glm::mat4(1);
+	num_uploads_last_commit_ = 0;
+	upload_buffer_ = 0;
 }
 
 
@@ -39,6 +31,7 @@ void InteractiveGrid::translate(float dx, float dy, float dz) {
 
 void InteractiveGrid::updateProjection(glm::mat4& p) {
 	last_view_projection_ = p;
+	inverse_view_projection_ = glm::inverse(p);
 }
 
 
@@ -52,21 +45,17 @@ glm::vec2 InteractiveGrid::getNDC(glm::vec2 position) {
 
 
 void InteractiveGrid::forEachCell(std::function<void(GridCell*)> callback) {
-	for (std::vector<GridCell> &row : cells_) {
-		for (GridCell &cell : row) {
-			callback(&cell);
-		}
+	// Storage order (row after row)
+	for (size_t i = 0; i < cells_.getNumCells(); i++) {
+		callback(cells_.getCell(i));
 	}
 }
 
 
 void InteractiveGrid::forEachCell(std::function<void(GridCell*,bool*)> callback) {
 	bool found = false;
-	for (std::vector<GridCell> &row : cells_) {
-		for (GridCell &cell : row) {
-			callback(&cell, &found);
-			if (found) break;
-		}
+	for (size_t i = 0; i < cells_.getNumCells(); i++) {
+		callback(cells_.getCell(i), &found);
 		if (found) break;
 	}
 }
@@ -77,7 +66,7 @@ void InteractiveGrid::forEachCellInRange(GridCell* leftLower, GridCell* rightUpp
 		return;
 	for (size_t i = leftLower->getCol(); i <= rightUpper->getCol(); i++) {
 		for (size_t j = leftLower->getRow(); j <= rightUpper->getRow(); j++) {
-			callback(&cells_[i][j]);
+			callback(cells_.getCell(i, j));
 		}
 	}
 }
@@ -89,7 +78,7 @@ void InteractiveGrid::forEachCellInRange(GridCell* leftLower, GridCell* rightUpp
 	bool found = false;
 	for (size_t i = leftLower->getCol(); i <= rightUpper->getCol(); i++) {
 		for (size_t j = leftLower->getRow(); j <= rightUpper->getRow(); j++) {
-			callback(&cells_[i][j], &found);
+			callback(cells_.getCell(i, j), &found);
 			if (found) break;
 		}
 		if (found) break;
@@ -98,16 +87,7 @@ void InteractiveGrid::forEachCellInRange(GridCell* leftLower, GridCell* rightUpp
 
 
 bool InteractiveGrid::isInsideGrid(glm::vec2 positionNDC) {
-	GridCell& leftUpperCell = cells_[0][cells_[0].size() - 1];
-	glm::vec2 posLeftUpperNDC = getNDC(leftUpperCell.getPosition());
-	if (positionNDC.x < posLeftUpperNDC.x || positionNDC.y > posLeftUpperNDC.y)
-		return false;
-	GridCell& rightLowerCell = cells_[cells_.size() - 1][0];
-	glm::vec2 posRightLowerNDC = getNDC(glm::vec2(
-		rightLowerCell.getXPosition() + cell_size_, rightLowerCell.getYPosition() - cell_size_ ));
-	if (positionNDC.x > posRightLowerNDC.x || positionNDC.y < posRightLowerNDC.y)
-		return false;
-	return true;
+	return getCellAt(positionNDC) != 0;
 }
 
 
@@ -124,38 +104,52 @@ bool InteractiveGrid::isInsideCell(glm::vec2 positionNDC, GridCell* cell) {
 
 
 GridCell* InteractiveGrid::getCellAt(glm::vec2 positionNDC) {
-	if (!isInsideGrid(positionNDC))
+	const glm::mat4& inv = inverse_view_projection_;
+	return pickCell(positionNDC, inv[3] - inv[2], inv[3] + inv[2]);
+}
+
+
+void InteractiveGrid::getCellsAt(const std::vector<glm::vec2>& positionsNDC, std::vector<GridCell*>& cells) {
+	const glm::mat4& inv = inverse_view_projection_;
+	glm::vec4 near_const = inv[3] - inv[2];
+	glm::vec4 far_const = inv[3] + inv[2];
+	cells.resize(positionsNDC.size());
+	for (size_t i = 0; i < positionsNDC.size(); i++)
+		cells[i] = pickCell(positionsNDC[i], near_const, far_const);
+}
+
+
+GridCell* InteractiveGrid::pickCell(glm::vec2 positionNDC, const glm::vec4& near_const, const glm::vec4& far_const) {
+	// Unprojected points on the near (z=-1) and far (z=1) plane are linear in x and y
+	// before the perspective divide, the constant parts come from the caller
+	const glm::mat4& inv = inverse_view_projection_;
+	glm::vec4 xy = inv[0] * positionNDC.x + inv[1] * positionNDC.y;
+	glm::vec4 near_h = xy + near_const;
+	glm::vec4 far_h = xy + far_const;
+	if (near_h.w == 0.0f || far_h.w == 0.0f) return 0;
+	glm::vec3 near_p = glm::vec3(near_h) / near_h.w;
+	glm::vec3 far_p = glm::vec3(far_h) / far_h.w;
+	// Intersect ray with the grid plane z = 0
+	glm::vec3 dir = far_p - near_p;
+	if (glm::abs(dir.z) < 1e-8f) return 0; // ray parallel to grid
+	glm::vec3 hit = near_p - dir * (near_p.z / dir.z);
+	return getCellAtGridPosition(glm::vec2(hit) - glm::vec2(translation_));
+}
+
+
+GridCell* InteractiveGrid::getCellAtGridPosition(glm::vec2 position) {
+	// Cell (col,row) spans from its position one cell to the right and one cell down
+	glm::vec2 rel = (position - cells_.getOrigin()) / cell_size_;
+	float col = glm::floor(rel.x);
+	float row = glm::floor(rel.y) + 1.0f;
+	if (col < 0.0f || row < 0.0f || col >= (float)getNumColumns() || row >= (float)getNumRows())
 		return 0;
-	size_t iLeftUpper = 0;
-	size_t jLeftUpper = cells_[0].size() - 1;
-	size_t iRightLower = cells_.size() - 1;
-	size_t jRightLower = 0;
-	while (iRightLower - iLeftUpper > 2 || jLeftUpper - jRightLower > 2) {
-		size_t iMiddle = iLeftUpper + (iRightLower - iLeftUpper) / 2;
-		size_t jMiddle = jRightLower + (jLeftUpper - jRightLower) / 2;
-		glm::vec2 cellNDC = getNDC(cells_[iMiddle][jMiddle].getPosition());
-		if (positionNDC.x < cellNDC.x)
-			iRightLower = iMiddle;
-		else
-			iLeftUpper = iMiddle;
-		if (positionNDC.y < cellNDC.y)
-			jLeftUpper = jMiddle;
-		else
-			jRightLower = jMiddle;
-	}
-	for (size_t i = iLeftUpper; i <= iRightLower; i++) {
-		for (size_t j = jRightLower; j <= jLeftUpper; j++) {
-			if (isInsideCell(positionNDC, &cells_[i][j]))
-				return &cells_[i][j];
-		}
-	}
-	return &cells_[iLeftUpper][jLeftUpper];
+	return cells_.getCell((size_t)col, (size_t)row);
 }
 
 
 GridCell* InteractiveGrid::getCellAt(size_t col, size_t row) {
-	if (col >= cells_.size() || row >= cells_[0].size()) return 0;
-	return &cells_[col][row];
+	return cells_.getCell(col, row);
 }
 
 
@@ -164,24 +158,22 @@ void InteractiveGrid::uploadVertexData() {
 	glBindVertexArray(vao_);
 	glGenBuffers(1, &vbo_);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-	size_t ncells = cells_.size() * cells_[0].size();
+	size_t ncells = getNumCells();
 	size_t bytes_per_cell = GridCell::getVertexBytes();
+	// Vertices are only built for the upload, cell i is at offset i * bytes_per_cell
+	std::vector<GLubyte> vertices(ncells * bytes_per_cell);
+	forEachCell([&](GridCell* cell) {
+		cell->copyVertexTo(&vertices[cell->getVertexBufferOffset()]);
+	});
 	glBufferData(GL_ARRAY_BUFFER,
 		ncells * bytes_per_cell,
-		(void*)0,
+		vertices.data(),
 		GL_STATIC_DRAW);
-	GLintptr offset = 0;
-	forEachCell([&](GridCell* cell) {
-		cell->setVertexBufferOffset(offset);
-		glBufferSubData(GL_ARRAY_BUFFER, offset,
-			bytes_per_cell,
-			cell->getVertexPointer());
-		offset += bytes_per_cell;
-	});
 	GridCell::setVertexAttribPointer();
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 	num_vertices_ = (GLsizei)ncells;
+	cells_.getDirtyCells().clear(); // all cells are uploaded
 }
 
 
@@ -199,8 +191,9 @@ void InteractiveGrid::onFrame() {
 	glBindVertexArray(vao_);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo_);
 	glUseProgram(shader_->getProgramId());
-	last_view_projection_[3] += glm::vec4(translation_, 0);
-	glUniformMatrix4fv(mvp_uniform_location_, 1, GL_FALSE, glm::value_ptr(last_view_projection_));
+	glm::mat4 mvp = last_view_projection_; // picking uses the matrix without grid translation
+	mvp[3] += glm::vec4(translation_, 0);
+	glUniformMatrix4fv(mvp_uniform_location_, 1, GL_FALSE, glm::value_ptr(mvp));
 	glDrawArrays(GL_POINTS, 0, num_vertices_);
 	glEnable(GL_DEPTH_TEST);
 }
@@ -233,7 +226,7 @@ void InteractiveGrid::buildAt(size_t col, size_t row, GridCell::BuildState build
 	GridCell* maybeCell = getCellAt(col, row);
 	if (!maybeCell) return;
 	if (maybeCell->getBuildState() == buildState) return;
-	maybeCell->updateBuildState(vbo_, buildState);
+	maybeCell->updateBuildState(buildState);
 }
 
 
@@ -249,39 +242,55 @@ void InteractiveGrid::buildAtLastMousePosition(GridCell::BuildState buildState)
 }
 
 
-bool InteractiveGrid::isColumnEmptyBetween(size_t col, size_t startRow, size_t endRow) {
-	if (endRow < startRow) {
-		size_t tmp = endRow;
-		endRow = startRow;
-		startRow = tmp;
-	}
-	GridCell* maybeCell = 0;
-	for (size_t i = startRow; i <= endRow; i++) {
-		maybeCell = getCellAt(col, i);
-		if (!maybeCell)
-			return false;
-		if (maybeCell->getBuildState() != GridCell::BuildState::EMPTY)
-			return false;
+void InteractiveGrid::commitEdits() {
+	num_uploads_last_commit_ = uploadEdits();
+}
+
+
+size_t InteractiveGrid::uploadEdits() {
+	DirtyRanges& dirty = cells_.getDirtyCells();
+	if (!vbo_) {
+		dirty.clear(); // not uploaded yet, uploadVertexData takes the current state
+		return 0;
 	}
-	return true;
+	if (dirty.isEmpty()) return 0;
+	size_t bytes_per_cell = GridCell::getVertexBytes();
+	size_t num_uploads = dirty.flush([&](size_t begin, size_t end) {
+		vertex_staging_.resize((end - begin) * bytes_per_cell);
+		for (size_t i = begin; i < end; i++)
+			cells_.getCell(i)->copyVertexTo(&vertex_staging_[(i - begin) * bytes_per_cell]);
+		upload_buffer_->upload(vbo_, begin * bytes_per_cell, vertex_staging_.data(), vertex_staging_.size());
+	});
+	return num_uploads;
+}
+
+
+void InteractiveGrid::setUploadBuffer(StreamingBuffer* upload_buffer) {
+	upload_buffer_ = upload_buffer;
+}
+
+
+bool InteractiveGrid::isColumnEmptyBetween(size_t col, size_t startRow, size_t endRow) {
+	if (endRow < startRow) std::swap(startRow, endRow);
+	if (col >= getNumColumns() || endRow >= getNumRows())
+		return false; // cells outside the grid count as occupied
+	return cells_.isColumnEmpty(col, startRow, endRow + 1);
 }
 
 
 bool InteractiveGrid::isRowEmptyBetween(size_t row, size_t startCol, size_t endCol) {
-	if (endCol < startCol) {
-		size_t tmp = endCol;
-		endCol = startCol;
-		startCol = tmp;
-	}
-	GridCell* maybeCell = 0;
-	for (size_t j = startCol; j <= endCol; j++) {
-		maybeCell = getCellAt(j, row);
-		if (!maybeCell)
-			return false;
-		if (maybeCell->getBuildState() != GridCell::BuildState::EMPTY)
-			return false;
-	}
-	return true;
+	if (endCol < startCol) std::swap(startCol, endCol);
+	if (row >= getNumRows() || endCol >= getNumColumns())
+		return false;
+	return cells_.isRowEmpty(row, startCol, endCol + 1);
+}
+
+
+bool InteractiveGrid::isRectEmpty(GridCell* leftLower, GridCell* rightUpper) {
+	if (leftLower->getCol() > rightUpper->getCol() || leftLower->getRow() > rightUpper->getRow())
+		return true;
+	return cells_.isRectEmpty(leftLower->getCol(), rightUpper->getCol() + 1,
+		leftLower->getRow(), rightUpper->getRow() + 1);
 }
 
 
@@ -291,15 +300,25 @@ float InteractiveGrid::getCellSize() {
 
 
 size_t InteractiveGrid::getNumColumns() {
-	return cells_.size();
+	return cells_.getNumColumns();
 }
 
 
 size_t InteractiveGrid::getNumRows() {
-	return cells_[0].size();
+	return cells_.getNumRows();
 }
 
 
 size_t InteractiveGrid::getNumCells() {
-	return cells_.size() * cells_[0].size();
+	return cells_.getNumCells();
+}
+
+
+GridCellStorage* InteractiveGrid::getCellStorage() {
+	return &cells_;
+}
+
+
+size_t InteractiveGrid::getNumUploadsLastCommit() {
+	return num_uploads_last_commit_;
 }
\ No newline at end of file
@@ -7,13 +7,15 @@
 #include "core/gfx/GPUProgram.h"
 #include "core/ApplicationNode.h"
 #include "GridInteraction.h"
+#include "GridCellStorage.h"
+#include "StreamingBuffer.h"
 
 class InteractiveGrid {
 protected:
 	// Data members
 	float height_units_;
 	float cell_size_;
-	std::vector<std::vector<GridCell>> cells_;
+	GridCellStorage cells_;
 	// Render-related members
 	GLuint vao_, vbo_;
 	std::shared_ptr<viscom::GPUProgram> shader_;
@@ -21,9 +23,17 @@ protected:
 	glm::vec3 translation_;
 	GLsizei num_vertices_;
 	glm::mat4 last_view_projection_;
+	glm::mat4 inverse_view_projection_; // for picking
+	// Edit-related members
+	std::vector<GLubyte> vertex_staging_;
+	size_t num_uploads_last_commit_;
+	StreamingBuffer* upload_buffer_;
 	// Input-related members
 	glm::dvec2 last_mouse_position_;
 	std::list<GridInteraction*> interactions_;
+	// Uploads all recorded edits, returns number of uploads
+	virtual size_t uploadEdits();
+	GridCell* pickCell(glm::vec2 positionNDC, const glm::vec4& near_const, const glm::vec4& far_const);
 public:
 	InteractiveGrid(size_t columns, size_t rows, float height);
 	~InteractiveGrid();
@@ -32,17 +42,23 @@ public:
 	void forEachCell(std::function<void(GridCell*,bool*)> callback);
 	void forEachCellInRange(GridCell* leftLower, GridCell* rightUpper, std::function<void(GridCell*)> callback);
 	void forEachCellInRange(GridCell* leftLower, GridCell* rightUpper, std::function<void(GridCell*,bool*)> callback);
+	// Picking intersects the view ray with the grid plane (constant time)
 	GridCell* getCellAt(glm::vec2 positionNDC);
+	// Resolves many touch points at once, the constant part of the unprojection is shared
+	void getCellsAt(const std::vector<glm::vec2>& positionsNDC, std::vector<GridCell*>& cells);
+	GridCell* getCellAtGridPosition(glm::vec2 position);
 	bool isInsideGrid(glm::vec2 positionNDC);
 	bool isInsideCell(glm::vec2 positionNDC, GridCell* cell);
 	bool isColumnEmptyBetween(size_t col, size_t startRow, size_t endRow);
 	bool isRowEmptyBetween(size_t row, size_t startCol, size_t endCol);
+	bool isRectEmpty(GridCell* leftLower, GridCell* rightUpper);
 	// Getters
 	float getCellSize();
 	size_t getNumColumns();
 	size_t getNumRows();
 	size_t getNumCells();
 	GridCell* getCellAt(size_t col, size_t row);
+	GridCellStorage* getCellStorage();
 	// Render functions
 	void uploadVertexData();
 	virtual void loadShader(viscom::GPUProgramManager mgr);
@@ -56,8 +72,13 @@ public:
 	glm::vec2 getNDC(glm::vec2 position);
 	void updateProjection(glm::mat4&);
 	// Functions for grid modification
+	// (edits are recorded on the CPU and uploaded by one commit per frame)
 	virtual void buildAt(size_t col, size_t row, GridCell::BuildState buildState);
 	void buildAtLastMousePosition(GridCell::BuildState buildState);
+	void commitEdits();
+	// Set before the first commit
+	void setUploadBuffer(StreamingBuffer* upload_buffer);
+	size_t getNumUploadsLastCommit();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "MaterialTextureArrays.h"
+
+MaterialTextureArrays::MaterialTextureArrays() :
+	sampler_(0),
+	is_built_(false)
+{
+}
+
+MaterialTextureArrays::~MaterialTextureArrays() {
+}
+
+MaterialTextureArrays::Layer MaterialTextureArrays::addTexture(const viscom::Texture* texture) {
+	if (!texture) return Layer();
+	auto it = layer_of_texture_.find(texture->getTextureId());
+	if (it != layer_of_texture_.end()) return it->second;
+	Layer l;
+	glm::uvec2 dimensions = texture->getDimensions();
+	for (size_t i = 0; i < arrays_.size(); i++) {
+		if (arrays_[i].dimensions_ == dimensions) {
+			l.array_index = (GLint)i;
+			break;
+		}
+	}
+	if (l.array_index < 0) {
+		if (arrays_.size() == MAX_ARRAYS) {
+			printf("Material texture arrays are full, texture with size %dx%d is ignored\n", dimensions.x, dimensions.y);
+			return Layer();
+		}
+		TextureArray a;
+		a.dimensions_ = dimensions;
+		a.id_ = 0;
+		arrays_.push_back(a);
+		l.array_index = (GLint)arrays_.size() - 1;
+	}
+	l.layer = (GLint)arrays_[l.array_index].textures_.size();
+	arrays_[l.array_index].textures_.push_back(texture);
+	layer_of_texture_[texture->getTextureId()] = l;
+	is_built_ = false;
+	return l;
+}
+
+void MaterialTextureArrays::build() {
+	if (is_built_) return;
+	if (sampler_ == 0) {
+		glGenSamplers(1, &sampler_);
+		glSamplerParameteri(sampler_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glSamplerParameteri(sampler_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(sampler_, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glSamplerParameteri(sampler_, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+	// Copy each texture into its layer (once at load time, through the CPU)
+	std::vector<GLubyte> pixels;
+	for (TextureArray& a : arrays_) {
+		if (a.id_ == 0) glGenTextures(1, &a.id_);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, a.id_);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, a.dimensions_.x, a.dimensions_.y,
+			(GLsizei)a.textures_.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)0);
+		pixels.resize(a.dimensions_.x * a.dimensions_.y * 4);
+		for (size_t layer = 0; layer < a.textures_.size(); layer++) {
+			glBindTexture(GL_TEXTURE_2D, a.textures_[layer]->getTextureId());
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)layer, a.dimensions_.x, a.dimensions_.y, 1,
+				GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	is_built_ = true;
+}
+
+void MaterialTextureArrays::bind(GLuint first_unit) {
+	for (size_t i = 0; i < arrays_.size(); i++) {
+		glActiveTexture(GL_TEXTURE0 + first_unit + (GLuint)i);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, arrays_[i].id_);
+		glBindSampler(first_unit + (GLuint)i, sampler_);
+	}
+}
+
+void MaterialTextureArrays::unbind(GLuint first_unit) {
+	for (size_t i = 0; i < arrays_.size(); i++)
+		glBindSampler(first_unit + (GLuint)i, 0);
+}
+
+void MaterialTextureArrays::clear() {
+	for (TextureArray& a : arrays_)
+		if (a.id_ != 0) glDeleteTextures(1, &a.id_);
+	arrays_.clear();
+	layer_of_texture_.clear();
+	if (sampler_ != 0) glDeleteSamplers(1, &sampler_);
+	sampler_ = 0;
+	is_built_ = false;
+}
+
+size_t MaterialTextureArrays::getNumArrays() {
+	return arrays_.size();
+}
+
+size_t MaterialTextureArrays::getNumLayers() {
+	return layer_of_texture_.size();
+}
\ No newline at end of file
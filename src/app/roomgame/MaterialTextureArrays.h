@@ -0,0 +1,49 @@
+#ifndef MATERIAL_TEXTURE_ARRAYS_H
+#define MATERIAL_TEXTURE_ARRAYS_H
+
+#include <unordered_map>
+#include <vector>
+#include "core/gfx/Texture.h"
+
+/*
+* Material textures repacked into texture arrays, one array per resolution.
+* A texture is addressed by (array index, layer), so meshes with different
+* materials can be drawn without texture state changes.
+* Sampling parameters live in one sampler object that is set up once.
+*/
+class MaterialTextureArrays {
+public:
+	// Number of arrays (resolutions) the shaders can address
+	static const size_t MAX_ARRAYS = 4;
+	struct Layer {
+		GLint array_index = -1; // -1 for no texture
+		GLint layer = -1;
+	};
+private:
+	struct TextureArray {
+		glm::uvec2 dimensions_;
+		std::vector<const viscom::Texture*> textures_;
+		GLuint id_;
+	};
+	std::vector<TextureArray> arrays_;
+	std::unordered_map<GLuint, Layer> layer_of_texture_;
+	GLuint sampler_;
+	bool is_built_;
+public:
+	MaterialTextureArrays();
+	~MaterialTextureArrays();
+	MaterialTextureArrays(const MaterialTextureArrays&) = delete;
+	MaterialTextureArrays& operator=(const MaterialTextureArrays&) = delete;
+	// Assigns a layer, textures are copied on build
+	Layer addTexture(const viscom::Texture* texture);
+	void build();
+	// Binds array i with the sampler to unit first_unit + i
+	void bind(GLuint first_unit);
+	// Removes the sampler again, it would override the parameters of other textures on these units
+	void unbind(GLuint first_unit);
+	void clear();
+	size_t getNumArrays();
+	size_t getNumLayers();
+};
+
+#endif
\ No newline at end of file
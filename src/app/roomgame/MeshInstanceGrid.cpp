@@ -7,22 +7,22 @@ MeshInstanceGrid::MeshInstanceGrid(size_t columns, size_t rows, float height, Ro
 }
 
 void MeshInstanceGrid::addInstanceAt(GridCell* c, GridCell::BuildState st) {
+	if (st == GridCell::BuildState::OUTER_INFLUENCE && meshpool_->isGpuDrivenOuterInfluence()) {
+		// Drawn from the automaton texture, the cell has no instance
+		c->setMeshInstance(RoomSegmentMesh::InstanceBufferRange());
+		return;
+	}
 	RoomSegmentMesh* mesh = meshpool_->getMeshOfType(st);
 	if (!mesh) return;
-	RoomSegmentMesh::Instance instance;
-	instance.scale = cell_size_ / 2.0f; // assume model extends [-1,1]^3
-	instance.translation = translation_; // grid translation
-	instance.translation += glm::vec3(c->getPosition(), 0.0f); // + relative cell translation
-	instance.translation += glm::vec3(cell_size_ / 2.0f, -cell_size_ / 2.0f, 0.0f); // with origin in middle of cell
-	instance.buildState = st;
-	instance.health = c->getHealthPoints();
+	// Transform is derived from the cell index and the grid geometry of the pool
+	RoomSegmentMesh::Instance instance(c->getRow() * getNumColumns() + c->getCol(), st, c->getHealthPoints());
 	c->setMeshInstance(mesh->addInstanceUnordered(instance));
 }
 
 void MeshInstanceGrid::removeInstanceAt(GridCell* c) {
 	RoomSegmentMesh::InstanceBufferRange bufferRange = c->getMeshInstance();
 	if (bufferRange.mesh_)
-		bufferRange.mesh_->removeInstanceUnordered(bufferRange.offset_instances_);
+		bufferRange.mesh_->removeInstance(bufferRange);
 }
 
 void MeshInstanceGrid::buildAt(GridCell* c, GridCell::BuildState newSt) {
@@ -34,7 +34,7 @@ void MeshInstanceGrid::buildAt(GridCell* c, GridCell::BuildState newSt) {
 		removeInstanceAt(c);
 		addInstanceAt(c, newSt);
 	}
-	c->updateBuildState(vbo_, newSt);
+	c->updateBuildState(newSt);
 }
 
 void MeshInstanceGrid::buildAt(size_t col, size_t row, GridCell::BuildState buildState) {
@@ -42,6 +42,17 @@ void MeshInstanceGrid::buildAt(size_t col, size_t row, GridCell::BuildState buil
 	if (maybeCell) buildAt(maybeCell, buildState);
 }
 
-void MeshInstanceGrid::onMeshpoolInitialized() {
+size_t MeshInstanceGrid::uploadEdits() {
+	meshpool_->setGridGeometry(glm::vec2(getNumColumns()*cell_size_, getNumRows()*cell_size_), translation_, cell_size_);
+	return InteractiveGrid::uploadEdits() + meshpool_->commitInstances();
+}
 
+void MeshInstanceGrid::onRoomFinished(Room* room) {
+	// Finished rooms do not move, draw them as static geometry
+	room->setBakedRoom(meshpool_->bakeRoom(room->getMeshInstances()));
+}
+
+void MeshInstanceGrid::onMeshpoolInitialized() {
+	// Instances only hold cell indices, the pool places them
+	meshpool_->setGridGeometry(glm::vec2(getNumColumns()*cell_size_, getNumRows()*cell_size_), translation_, cell_size_);
 }
\ No newline at end of file
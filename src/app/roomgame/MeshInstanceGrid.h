@@ -11,6 +11,8 @@ protected:
 	RoomSegmentMeshPool* meshpool_;
 	void addInstanceAt(GridCell*, GridCell::BuildState);
 	void removeInstanceAt(GridCell*);
+	virtual size_t uploadEdits() override;
+	virtual void onRoomFinished(Room* room) override;
 public:
 	MeshInstanceGrid(size_t columns, size_t rows, float height, RoomSegmentMeshPool* meshpool);
 	virtual void buildAt(size_t col, size_t row, GridCell::BuildState buildState) override;
@@ -1,4 +1,7 @@
 #include "OuterInfluenceAutomaton.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 
 OuterInfluenceAutomaton::OuterInfluenceAutomaton(AutomatonGrid* grid, double transition_time) :
 	GPUCellularAutomaton(grid, transition_time),
@@ -7,35 +10,133 @@ OuterInfluenceAutomaton::OuterInfluenceAutomaton(AutomatonGrid* grid, double tra
 	death_thd_(0.5f),
 	room_nbors_ahead_thd_(0.2f),
 	outer_infl_nbors_thd_(1),
-	damage_per_cell_(5)
+	damage_per_cell_(5),
+	cpu_backend_(false),
+	cpu_generation_stale_(false),
+	cpu_kernel_(OuterInfluenceRules::getBestKernel()),
+	cpu_threads_(1),
+	cpu_step_ms_(0.0)
 {
-
+	// Leave one core for rendering
+	unsigned int cores = std::thread::hardware_concurrency();
+	if (cores > 1) cpu_threads_ = cores - 1;
 }
 
 void OuterInfluenceAutomaton::init(viscom::GPUProgramManager mgr) {
 	GPUCellularAutomaton::init(mgr);
 	movedir_uniform_location_ = shader_->getUniformLocation("moveDirection");
-	birth_thd_uloc_ = shader_->getUniformLocation("BIRTH_THRESHOLD");
-	death_thd_uloc_ = shader_->getUniformLocation("DEATH_THRESHOLD");
-	room_nbors_ahead_thd_uloc_ = shader_->getUniformLocation("ROOM_NBORS_AHEAD_THRESHOLD");
+	birth_thd_uloc_ = shader_->getUniformLocation("BIRTH_MIN_NBORS_BEHIND");
+	death_thd_uloc_ = shader_->getUniformLocation("DEATH_MIN_NBORS_BEHIND");
+	room_nbors_ahead_thd_uloc_ = shader_->getUniformLocation("SPLIT_MIN_ROOM_NBORS_AHEAD");
 	outer_infl_nbors_thd_uloc_ = shader_->getUniformLocation("OUTER_INFL_NBORS_THRESHOLD");
 	damage_per_cell_uloc_ = shader_->getUniformLocation("DAMAGE_PER_CELL");
+	if (cpu_backend_) syncCpuGeneration();
 }
 
 
 void OuterInfluenceAutomaton::transition(double time) {
+	if (cpu_backend_) {
+		transitionOnCpu(time);
+		return;
+	}
 	if (is_initialized_) {
+		OuterInfluenceRules::Params p = getRuleParams();
 		glUseProgram(shader_->getProgramId());
-		glUniform2i(movedir_uniform_location_, movedir_.x, movedir_.y);
-		glUniform1f(birth_thd_uloc_, birth_thd_);
-		glUniform1f(death_thd_uloc_, death_thd_);
-		glUniform1f(room_nbors_ahead_thd_uloc_, room_nbors_ahead_thd_);
-		glUniform1i(outer_infl_nbors_thd_uloc_, outer_infl_nbors_thd_);
-		glUniform1i(damage_per_cell_uloc_, damage_per_cell_);
+		glUniform2i(movedir_uniform_location_, p.move_x, p.move_y);
+		glUniform1i(birth_thd_uloc_, p.birth_min_nbors_behind);
+		glUniform1i(death_thd_uloc_, p.death_min_nbors_behind);
+		glUniform1i(room_nbors_ahead_thd_uloc_, p.split_min_room_nbors_ahead);
+		glUniform1i(outer_infl_nbors_thd_uloc_, p.split_min_outer_infl_nbors);
+		glUniform1i(damage_per_cell_uloc_, p.damage_per_cell);
 	}
 	GPUCellularAutomaton::transition(time);
 }
 
+void OuterInfluenceAutomaton::transitionOnCpu(double time) {
+	if (!is_initialized_) return;
+	pollReadbacks(); // generations computed on the gpu before switching
+	if (!advanceClock(time)) return;
+	if (cpu_generation_stale_) syncCpuGeneration();
+	commitCellEdits(); // already in the cpu generation, but the texture is read for rendering
+	int current_write_index = (current_read_index_ == 0) ? 1 : 0;
+	size_t cols = grid_->getNumColumns();
+	size_t rows = grid_->getNumRows();
+	const std::vector<GLubyte>& in = cpu_generation_[current_read_index_];
+	std::vector<GLubyte>& out = cpu_generation_[current_write_index];
+	OuterInfluenceRules::Params p = getRuleParams();
+	auto start = std::chrono::high_resolution_clock::now();
+	if (cpu_threads_ > 1) {
+		// Each cell only depends on the previous generation,
+		// so the result does not depend on how tiles are scheduled
+		if (!cpu_pool_ || cpu_pool_->getNumThreads() != cpu_threads_)
+			cpu_pool_.reset(new WorkStealingPool(cpu_threads_));
+		size_t tiles_x = (cols + TILE_COLUMNS - 1) / TILE_COLUMNS;
+		size_t tiles_y = (rows + TILE_ROWS - 1) / TILE_ROWS;
+		cpu_pool_->parallelFor(tiles_x * tiles_y, [&](size_t tile) {
+			size_t tx = tile % tiles_x;
+			size_t ty = tile / tiles_x;
+			OuterInfluenceRules::stepTile(in.data(), out.data(), cols, rows,
+				tx * TILE_COLUMNS, std::min(cols, (tx + 1) * TILE_COLUMNS),
+				ty * TILE_ROWS, std::min(rows, (ty + 1) * TILE_ROWS), p, cpu_kernel_);
+		});
+	}
+	else OuterInfluenceRules::step(in.data(), out.data(), cols, rows, p, cpu_kernel_);
+	cpu_step_ms_ = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	// Texture is still used for rendering
+	glBindTexture(GL_TEXTURE_2D, texture_pair_[current_write_index].id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)cols, (GLsizei)rows,
+		texture_pair_[current_write_index].format, texture_pair_[current_write_index].datatype, out.data());
+	// Update grid
+	grid_->onTransition();
+	num_changed_cells_ = 0;
+	for (size_t row = 0; row < rows; row++) {
+		size_t first = row * cols;
+		if (memcmp(&in[2 * first], &out[2 * first], 2 * cols) == 0) continue; // skip quiet rows
+		for (size_t i = first; i < first + cols; i++) {
+			if (in[2 * i] == out[2 * i] && in[2 * i + 1] == out[2 * i + 1]) continue;
+			num_changed_cells_++;
+			GridCell* c = grid_->getCellAt(i % cols, row);
+			if (c->getBuildState() != (int)out[2 * i] || c->getHealthPoints() != (int)out[2 * i + 1])
+				grid_->updateCell(c, (GridCell::BuildState)out[2 * i], out[2 * i + 1]);
+		}
+	}
+	applied_generation_ = ++num_generations_; // grid is up to date with the texture
+	// Swap buffers
+	current_read_index_ = current_write_index;
+}
+
+void OuterInfluenceAutomaton::syncCpuGeneration() {
+	// Continue from the generation the gpu computed last
+	commitCellEdits();
+	while (consumeOldestReadback(true));
+	for (std::vector<GLubyte>& generation : cpu_generation_)
+		generation.resize(getClientBufferBytes());
+	glBindTexture(GL_TEXTURE_2D, texture_pair_[current_read_index_].id);
+	glGetTexImage(GL_TEXTURE_2D, 0, texture_pair_[current_read_index_].format,
+		texture_pair_[current_read_index_].datatype, cpu_generation_[current_read_index_].data());
+	cpu_generation_stale_ = false;
+}
+
+void OuterInfluenceAutomaton::updateCell(GridCell* c, GLint state, GLint hp) {
+	GPUCellularAutomaton::updateCell(c, state, hp);
+	if (!cpu_backend_ || !is_initialized_) return;
+	size_t i = c->getRow() * grid_->getNumColumns() + c->getCol();
+	cpu_generation_[current_read_index_][2 * i] = (GLubyte)state;
+	cpu_generation_[current_read_index_][2 * i + 1] = (GLubyte)hp;
+}
+
+void OuterInfluenceAutomaton::applyReplicatedState(const GLubyte* state_health, const std::vector<size_t>& changed_cells,
+	size_t generation, double time) {
+	GPUCellularAutomaton::applyReplicatedState(state_health, changed_cells, generation, time);
+	// Read back once when the local simulation is resumed, instead of copying every message
+	cpu_generation_stale_ = true;
+}
+
+OuterInfluenceRules::Params OuterInfluenceAutomaton::getRuleParams() {
+	return OuterInfluenceRules::makeParams(movedir_.x, movedir_.y, birth_thd_, death_thd_,
+		room_nbors_ahead_thd_, outer_infl_nbors_thd_, damage_per_cell_);
+}
+
 void OuterInfluenceAutomaton::setMoveDir(int x, int y) {
 	movedir_.x = x;
 	movedir_.y = y;
@@ -59,4 +160,39 @@ void OuterInfluenceAutomaton::setOuterInfluenceNeighborThreshold(GLint v) {
 
 void OuterInfluenceAutomaton::setDamagePerCell(GLint v) {
 	damage_per_cell_ = v;
+}
+
+void OuterInfluenceAutomaton::setCpuBackend(bool on) {
+	if (on == cpu_backend_) return;
+	cpu_backend_ = on;
+	// Switching to gpu needs no sync, the cpu uploads every generation
+	if (cpu_backend_ && is_initialized_) syncCpuGeneration();
+}
+
+void OuterInfluenceAutomaton::setCpuKernel(OuterInfluenceRules::Kernel k) {
+	cpu_kernel_ = k;
+}
+
+void OuterInfluenceAutomaton::setCpuThreads(size_t n) {
+	cpu_threads_ = (n > 0) ? n : 1; // pool is rebuilt on the next cpu transition
+}
+
+bool OuterInfluenceAutomaton::isCpuBackend() {
+	return cpu_backend_;
+}
+
+OuterInfluenceRules::Kernel OuterInfluenceAutomaton::getCpuKernel() {
+	return cpu_kernel_;
+}
+
+size_t OuterInfluenceAutomaton::getCpuThreads() {
+	return cpu_threads_;
+}
+
+double OuterInfluenceAutomaton::getCpuStepMilliseconds() {
+	return cpu_step_ms_;
+}
+
+size_t OuterInfluenceAutomaton::getCpuSteals() {
+	return cpu_pool_ ? cpu_pool_->getNumSteals() : 0;
 }
\ No newline at end of file
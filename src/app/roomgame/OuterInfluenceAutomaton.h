@@ -2,6 +2,8 @@
 #define OUTER_INFLUENCE_AUTOMATON_H
 
 #include "GPUCellularAutomaton.h"
+#include "OuterInfluenceRules.h"
+#include "WorkStealingPool.h"
 
 class OuterInfluenceAutomaton : public GPUCellularAutomaton {
 	GLint movedir_uniform_location_;
@@ -16,6 +18,19 @@ class OuterInfluenceAutomaton : public GPUCellularAutomaton {
 	GLint outer_infl_nbors_thd_;
 	GLint damage_per_cell_uloc_;
 	GLint damage_per_cell_;
+	// CPU backend (same rules, double-buffered like texture_pair_)
+	bool cpu_backend_;
+	OuterInfluenceRules::Kernel cpu_kernel_;
+	std::vector<GLubyte> cpu_generation_[2];
+	bool cpu_generation_stale_; // replicated state was only written to the texture
+	std::unique_ptr<WorkStealingPool> cpu_pool_; // steps tiles in parallel
+	size_t cpu_threads_;
+	double cpu_step_ms_;
+	static const size_t TILE_COLUMNS = 256; // tile rows of 512 bytes
+	static const size_t TILE_ROWS = 32; // ~16 KB in + 16 KB out per tile
+	OuterInfluenceRules::Params getRuleParams();
+	void syncCpuGeneration();
+	void transitionOnCpu(double time);
 public:
 	OuterInfluenceAutomaton(AutomatonGrid* grid, double transition_time);
 	void init(viscom::GPUProgramManager mgr);
@@ -26,6 +41,17 @@ public:
 	void setOuterInfluenceNeighborThreshold(GLint v);
 	void setDamagePerCell(GLint v);
 	void transition(double time);
+	void updateCell(GridCell* c, GLint state, GLint hp) override;
+	void applyReplicatedState(const GLubyte* state_health, const std::vector<size_t>& changed_cells,
+		size_t generation, double time) override;
+	void setCpuBackend(bool on);
+	void setCpuKernel(OuterInfluenceRules::Kernel k);
+	void setCpuThreads(size_t n);
+	bool isCpuBackend();
+	OuterInfluenceRules::Kernel getCpuKernel();
+	size_t getCpuThreads();
+	double getCpuStepMilliseconds();
+	size_t getCpuSteals(); // tiles run by another thread than the one they were queued on
 };
 
 #endif
\ No newline at end of file
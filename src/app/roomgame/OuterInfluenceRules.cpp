@@ -0,0 +1,302 @@
+#include "OuterInfluenceRules.h"
+
+// Vector kernels are compiled when the build targets the instruction set
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OUTER_INFLUENCE_RULES_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OUTER_INFLUENCE_RULES_SSE2
+#endif
+
+namespace {
+	// Same values as GridCell::BuildState and the BSTATE_ constants in the shader
+	const int BSTATE_EMPTY = 0;
+	const int BSTATE_INSIDE_ROOM = 1;
+	const int BSTATE_WALL_BOTTOM = 9;
+	const int BSTATE_OUTER_INFLUENCE = 11;
+	const int MAX_HEALTH = 100;
+	// Damage is computed in 16 bit lanes: 8 neighbors * damage + 255 must fit
+	const int MAX_SIMD_DAMAGE = 4000;
+
+	inline int isOuterInfluence(int st) {
+		return (st == BSTATE_OUTER_INFLUENCE) ? 1 : 0;
+	}
+
+	inline int isRoom(int st) {
+		return (st >= BSTATE_INSIDE_ROOM && st <= BSTATE_WALL_BOTTOM) ? 1 : 0;
+	}
+
+	inline int clampInt(int v, int lo, int hi) {
+		return (v < lo) ? lo : ((v > hi) ? hi : v);
+	}
+
+#ifdef OUTER_INFLUENCE_RULES_SSE2
+	// One cell per 16 bit lane: low byte = build state, high byte = health
+	struct Sse2Ops {
+		typedef __m128i V;
+		static const size_t LANES = 8;
+		static V load(const uint8_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+		static void store(uint8_t* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+		static V set1(int x) { return _mm_set1_epi16((short)x); }
+		static V zero() { return _mm_setzero_si128(); }
+		static V add(V a, V b) { return _mm_add_epi16(a, b); }
+		static V sub(V a, V b) { return _mm_sub_epi16(a, b); }
+		static V mul(V a, V b) { return _mm_mullo_epi16(a, b); }
+		static V min(V a, V b) { return _mm_min_epi16(a, b); }
+		static V max(V a, V b) { return _mm_max_epi16(a, b); }
+		static V eq(V a, V b) { return _mm_cmpeq_epi16(a, b); }
+		static V gt(V a, V b) { return _mm_cmpgt_epi16(a, b); }
+		static V and_(V a, V b) { return _mm_and_si128(a, b); }
+		static V or_(V a, V b) { return _mm_or_si128(a, b); }
+		static V select(V mask, V a, V b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+		static V lowByte(V a) { return _mm_and_si128(a, _mm_set1_epi16(0xFF)); }
+		static V highByte(V a) { return _mm_srli_epi16(a, 8); }
+		static V toHighByte(V a) { return _mm_slli_epi16(a, 8); }
+	};
+#endif
+
+#ifdef OUTER_INFLUENCE_RULES_AVX2
+	struct Avx2Ops {
+		typedef __m256i V;
+		static const size_t LANES = 16;
+		static V load(const uint8_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+		static void store(uint8_t* p, V v) { _mm256_storeu_si256((__m256i*)p, v); }
+		static V set1(int x) { return _mm256_set1_epi16((short)x); }
+		static V zero() { return _mm256_setzero_si256(); }
+		static V add(V a, V b) { return _mm256_add_epi16(a, b); }
+		static V sub(V a, V b) { return _mm256_sub_epi16(a, b); }
+		static V mul(V a, V b) { return _mm256_mullo_epi16(a, b); }
+		static V min(V a, V b) { return _mm256_min_epi16(a, b); }
+		static V max(V a, V b) { return _mm256_max_epi16(a, b); }
+		static V eq(V a, V b) { return _mm256_cmpeq_epi16(a, b); }
+		static V gt(V a, V b) { return _mm256_cmpgt_epi16(a, b); }
+		static V and_(V a, V b) { return _mm256_and_si256(a, b); }
+		static V or_(V a, V b) { return _mm256_or_si256(a, b); }
+		static V select(V mask, V a, V b) { return _mm256_blendv_epi8(b, a, mask); }
+		static V lowByte(V a) { return _mm256_and_si256(a, _mm256_set1_epi16(0xFF)); }
+		static V highByte(V a) { return _mm256_srli_epi16(a, 8); }
+		static V toHighByte(V a) { return _mm256_slli_epi16(a, 8); }
+	};
+#endif
+
+	// Steps cells of one row from col on in blocks of LANES, while the block
+	// ends before col_end, and returns the first column not stepped.
+	// col_end must not exceed cols - 1, so that no neighbor wraps around.
+	// Comparison masks are all ones (-1), so subtracting a mask counts it.
+	template<typename Ops>
+	size_t stepRowSimd(const uint8_t* in, uint8_t* out, size_t cols, size_t rows,
+		size_t row, size_t col, size_t col_end, const OuterInfluenceRules::Params& p)
+	{
+		typedef typename Ops::V V;
+		const V empty = Ops::zero();
+		const V outerInfl = Ops::set1(BSTATE_OUTER_INFLUENCE);
+		const V belowRoom = Ops::set1(BSTATE_INSIDE_ROOM - 1);
+		const V aboveRoom = Ops::set1(BSTATE_WALL_BOTTOM + 1);
+		const V maxHealth = Ops::set1(MAX_HEALTH);
+		// Counts are in [0,8], so thresholds outside [0,9] behave like the bounds
+		const V birthBelow = Ops::set1(clampInt(p.birth_min_nbors_behind, 0, 9) - 1);
+		const V deathMin = Ops::set1(clampInt(p.death_min_nbors_behind, 0, 9));
+		const V splitAheadBelow = Ops::set1(clampInt(p.split_min_room_nbors_ahead, 0, 9) - 1);
+		const V splitNborsBelow = Ops::set1(clampInt(p.split_min_outer_infl_nbors, 0, 9) - 1);
+		const V damage = Ops::set1(p.damage_per_cell);
+		const uint8_t* rowN = in + ((row + 1) % rows) * cols * 2;
+		const uint8_t* rowC = in + row * cols * 2;
+		const uint8_t* rowS = in + ((row + rows - 1) % rows) * cols * 2;
+		for (; col + Ops::LANES <= col_end; col += Ops::LANES) {
+			size_t o = col * 2;
+			V self = Ops::load(rowC + o);
+			V st = Ops::lowByte(self);
+			V hp = Ops::highByte(self);
+			V sN = Ops::lowByte(Ops::load(rowN + o));
+			V sNE = Ops::lowByte(Ops::load(rowN + o + 2));
+			V sE = Ops::lowByte(Ops::load(rowC + o + 2));
+			V sSE = Ops::lowByte(Ops::load(rowS + o + 2));
+			V sS = Ops::lowByte(Ops::load(rowS + o));
+			V sSW = Ops::lowByte(Ops::load(rowS + o - 2));
+			V sW = Ops::lowByte(Ops::load(rowC + o - 2));
+			V sNW = Ops::lowByte(Ops::load(rowN + o - 2));
+			// Outer influence neighbors per direction
+			V oN = Ops::eq(sN, outerInfl), oNE = Ops::eq(sNE, outerInfl);
+			V oE = Ops::eq(sE, outerInfl), oSE = Ops::eq(sSE, outerInfl);
+			V oS = Ops::eq(sS, outerInfl), oSW = Ops::eq(sSW, outerInfl);
+			V oW = Ops::eq(sW, outerInfl), oNW = Ops::eq(sNW, outerInfl);
+			V oPosX = Ops::sub(Ops::sub(Ops::sub(empty, oNE), oE), oSE);
+			V oPosY = Ops::sub(Ops::sub(Ops::sub(empty, oN), oNE), oNW);
+			V oNegX = Ops::sub(Ops::sub(Ops::sub(empty, oW), oNW), oSW);
+			V oNegY = Ops::sub(Ops::sub(Ops::sub(empty, oS), oSE), oSW);
+			V oTotal = Ops::sub(Ops::sub(Ops::add(oPosX, oNegX), oN), oS);
+			// Room neighbors per direction
+			V rN = Ops::and_(Ops::gt(sN, belowRoom), Ops::gt(aboveRoom, sN));
+			V rNE = Ops::and_(Ops::gt(sNE, belowRoom), Ops::gt(aboveRoom, sNE));
+			V rE = Ops::and_(Ops::gt(sE, belowRoom), Ops::gt(aboveRoom, sE));
+			V rSE = Ops::and_(Ops::gt(sSE, belowRoom), Ops::gt(aboveRoom, sSE));
+			V rS = Ops::and_(Ops::gt(sS, belowRoom), Ops::gt(aboveRoom, sS));
+			V rSW = Ops::and_(Ops::gt(sSW, belowRoom), Ops::gt(aboveRoom, sSW));
+			V rW = Ops::and_(Ops::gt(sW, belowRoom), Ops::gt(aboveRoom, sW));
+			V rNW = Ops::and_(Ops::gt(sNW, belowRoom), Ops::gt(aboveRoom, sNW));
+			V rPosX = Ops::sub(Ops::sub(Ops::sub(empty, rNE), rE), rSE);
+			V rPosY = Ops::sub(Ops::sub(Ops::sub(empty, rN), rNE), rNW);
+			V rNegX = Ops::sub(Ops::sub(Ops::sub(empty, rW), rNW), rSW);
+			V rNegY = Ops::sub(Ops::sub(Ops::sub(empty, rS), rSE), rSW);
+			V rTotal = Ops::sub(Ops::sub(Ops::add(rPosX, rNegX), rN), rS);
+			// Move rule
+			V behind = empty;
+			if (p.move_x != 0) behind = Ops::add(behind, (p.move_x > 0) ? oNegX : oPosX);
+			if (p.move_y != 0) behind = Ops::add(behind, (p.move_y > 0) ? oNegY : oPosY);
+			V isEmpty = Ops::eq(st, empty);
+			V isOuterInfl = Ops::eq(st, outerInfl);
+			V birth = Ops::and_(isEmpty, Ops::gt(behind, birthBelow));
+			V death = Ops::and_(isOuterInfl, Ops::gt(deathMin, behind));
+			V newSt = Ops::select(birth, outerInfl, Ops::select(death, empty, st));
+			// Split rule
+			V ahead = empty;
+			if (p.move_x != 0) ahead = Ops::add(ahead, (p.move_x > 0) ? rPosX : rNegX);
+			if (p.move_y != 0) ahead = Ops::add(ahead, (p.move_y > 0) ? rPosY : rNegY);
+			V split = Ops::and_(Ops::and_(Ops::eq(newSt, empty), Ops::gt(ahead, splitAheadBelow)),
+				Ops::gt(oTotal, splitNborsBelow));
+			newSt = Ops::select(split, outerInfl, newSt);
+			// Damage rule
+			V isRoomCell = Ops::and_(Ops::gt(st, belowRoom), Ops::gt(aboveRoom, st));
+			V roomHp = Ops::min(Ops::max(Ops::sub(hp, Ops::mul(oTotal, damage)), empty), maxHealth);
+			V outerInflHp = Ops::min(Ops::max(Ops::sub(hp, Ops::mul(rTotal, damage)), empty), maxHealth);
+			V newHp = Ops::select(isRoomCell, roomHp, Ops::select(isOuterInfl, outerInflHp, hp));
+			newSt = Ops::select(Ops::eq(newHp, empty), empty, newSt);
+			newHp = Ops::select(Ops::eq(newSt, empty), maxHealth, newHp);
+			Ops::store(out + row * cols * 2 + o, Ops::or_(newSt, Ops::toHighByte(newHp)));
+		}
+		return col;
+	}
+}
+
+OuterInfluenceRules::Params OuterInfluenceRules::makeParams(int move_x, int move_y, float birth_thd, float death_thd,
+	float room_nbors_ahead_thd, int outer_infl_nbors_thd, int damage_per_cell)
+{
+	Params p;
+	p.move_x = clampInt(move_x, -1, 1);
+	p.move_y = clampInt(move_y, -1, 1);
+	// Neighbor counts are normalized by 6 on diagonal moves, else by 3
+	float divisor = (p.move_x != 0 && p.move_y != 0) ? 6.0f : 3.0f;
+	p.birth_min_nbors_behind = minCount(birth_thd, divisor, false);
+	p.death_min_nbors_behind = minCount(death_thd, divisor, true);
+	p.split_min_room_nbors_ahead = minCount(room_nbors_ahead_thd, divisor, false);
+	p.split_min_outer_infl_nbors = outer_infl_nbors_thd;
+	p.damage_per_cell = damage_per_cell;
+	return p;
+}
+
+int OuterInfluenceRules::minCount(float thd, float divisor, bool inclusive) {
+	// Smallest count n with n/divisor > thd (or >= thd), 9 if no count in [0,8] qualifies
+	for (int n = 0; n <= 8; n++) {
+		float normalized = (float)n / divisor;
+		if (normalized > thd || (inclusive && normalized == thd)) return n;
+	}
+	return 9;
+}
+
+void OuterInfluenceRules::stepCell(const uint8_t* in, uint8_t* out, size_t cols, size_t rows,
+	size_t col, size_t row, const Params& p)
+{
+	// Torus: neighbors wrap around like GL_REPEAT in the shader
+	size_t n = (row + 1) % rows;
+	size_t s = (row + rows - 1) % rows;
+	size_t e = (col + 1) % cols;
+	size_t w = (col + cols - 1) % cols;
+	int st = in[(row * cols + col) * 2];
+	int hp = in[(row * cols + col) * 2 + 1];
+	int sN = in[(n * cols + col) * 2];
+	int sNE = in[(n * cols + e) * 2];
+	int sE = in[(row * cols + e) * 2];
+	int sSE = in[(s * cols + e) * 2];
+	int sS = in[(s * cols + col) * 2];
+	int sSW = in[(s * cols + w) * 2];
+	int sW = in[(row * cols + w) * 2];
+	int sNW = in[(n * cols + w) * 2];
+	int oPosX = isOuterInfluence(sNE) + isOuterInfluence(sE) + isOuterInfluence(sSE);
+	int oPosY = isOuterInfluence(sN) + isOuterInfluence(sNE) + isOuterInfluence(sNW);
+	int oNegX = isOuterInfluence(sW) + isOuterInfluence(sNW) + isOuterInfluence(sSW);
+	int oNegY = isOuterInfluence(sS) + isOuterInfluence(sSE) + isOuterInfluence(sSW);
+	int oTotal = oPosX + oNegX + isOuterInfluence(sN) + isOuterInfluence(sS);
+	int rPosX = isRoom(sNE) + isRoom(sE) + isRoom(sSE);
+	int rPosY = isRoom(sN) + isRoom(sNE) + isRoom(sNW);
+	int rNegX = isRoom(sW) + isRoom(sNW) + isRoom(sSW);
+	int rNegY = isRoom(sS) + isRoom(sSE) + isRoom(sSW);
+	int rTotal = rPosX + rNegX + isRoom(sN) + isRoom(sS);
+	// Move rule
+	int behind = 0;
+	if (p.move_x != 0) behind += (p.move_x > 0) ? oNegX : oPosX;
+	if (p.move_y != 0) behind += (p.move_y > 0) ? oNegY : oPosY;
+	int newSt = st;
+	if (st == BSTATE_EMPTY && behind >= p.birth_min_nbors_behind)
+		newSt = BSTATE_OUTER_INFLUENCE; // birth
+	else if (st == BSTATE_OUTER_INFLUENCE && behind < p.death_min_nbors_behind)
+		newSt = BSTATE_EMPTY; // death
+	// Split rule
+	int ahead = 0;
+	if (p.move_x != 0) ahead += (p.move_x > 0) ? rPosX : rNegX;
+	if (p.move_y != 0) ahead += (p.move_y > 0) ? rPosY : rNegY;
+	if (newSt == BSTATE_EMPTY && ahead >= p.split_min_room_nbors_ahead
+		&& oTotal >= p.split_min_outer_infl_nbors) newSt = BSTATE_OUTER_INFLUENCE;
+	// Damage rule
+	int newHp = hp;
+	if (isRoom(st))
+		newHp = clampInt(hp - oTotal * p.damage_per_cell, 0, MAX_HEALTH);
+	else if (st == BSTATE_OUTER_INFLUENCE)
+		newHp = clampInt(hp - rTotal * p.damage_per_cell, 0, MAX_HEALTH);
+	if (newHp == 0) newSt = BSTATE_EMPTY;
+	if (newSt == BSTATE_EMPTY) newHp = MAX_HEALTH;
+	out[(row * cols + col) * 2] = (uint8_t)newSt;
+	out[(row * cols + col) * 2 + 1] = (uint8_t)newHp;
+}
+
+void OuterInfluenceRules::stepRows(const uint8_t* in, uint8_t* out, size_t cols, size_t rows,
+	size_t row_begin, size_t row_end, const Params& p, Kernel k)
+{
+	stepTile(in, out, cols, rows, 0, cols, row_begin, row_end, p, k);
+}
+
+void OuterInfluenceRules::stepTile(const uint8_t* in, uint8_t* out, size_t cols, size_t rows,
+	size_t col_begin, size_t col_end, size_t row_begin, size_t row_end, const Params& p, Kernel k)
+{
+	bool simd = p.damage_per_cell >= -MAX_SIMD_DAMAGE && p.damage_per_cell <= MAX_SIMD_DAMAGE;
+	// Column 0 and the last column wrap around, they are done by the scalar path
+	size_t simd_begin = (col_begin > 0) ? col_begin : 1;
+	size_t simd_end = (col_end < cols - 1) ? col_end : cols - 1;
+	for (size_t row = row_begin; row < row_end; row++) {
+		size_t col = col_begin;
+		if (col == 0 && col < col_end) stepCell(in, out, cols, rows, col++, row, p);
+		if (simd && simd_begin < simd_end) {
+#ifdef OUTER_INFLUENCE_RULES_AVX2
+			if (k >= AVX2) col = stepRowSimd<Avx2Ops>(in, out, cols, rows, row, col, simd_end, p);
+#endif
+#ifdef OUTER_INFLUENCE_RULES_SSE2
+			if (k >= SSE2) col = stepRowSimd<Sse2Ops>(in, out, cols, rows, row, col, simd_end, p);
+#endif
+		}
+		for (; col < col_end; col++)
+			stepCell(in, out, cols, rows, col, row, p);
+	}
+}
+
+void OuterInfluenceRules::step(const uint8_t* in, uint8_t* out, size_t cols, size_t rows, const Params& p, Kernel k) {
+	stepRows(in, out, cols, rows, 0, rows, p, k);
+}
+
+OuterInfluenceRules::Kernel OuterInfluenceRules::getBestKernel() {
+#if defined(OUTER_INFLUENCE_RULES_AVX2)
+	return AVX2;
+#elif defined(OUTER_INFLUENCE_RULES_SSE2)
+	return SSE2;
+#else
+	return SCALAR;
+#endif
+}
+
+const char* OuterInfluenceRules::getKernelName(Kernel k) {
+	switch (k) {
+	case AVX2: return "AVX2";
+	case SSE2: return "SSE2";
+	default: return "scalar";
+	}
+}
\ No newline at end of file
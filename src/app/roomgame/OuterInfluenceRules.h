@@ -0,0 +1,46 @@
+#ifndef OUTER_INFLUENCE_RULES_H
+#define OUTER_INFLUENCE_RULES_H
+
+#include <cstdint>
+#include <cstddef>
+
+// CPU implementation of the rules in cellularAutomaton.frag
+// Works on the same memory layout as the RG8 automaton texture:
+// two bytes (build state, health) per cell, row after row.
+// Needs no OpenGL context.
+class OuterInfluenceRules {
+public:
+	enum Kernel {
+		SCALAR = 0,
+		SSE2 = 1,
+		AVX2 = 2
+	};
+	// Thresholds as neighbor counts, so that CPU and shader compare integers
+	// and produce bit-identical generations
+	struct Params {
+		int move_x; // each in {-1,0,1}
+		int move_y;
+		int birth_min_nbors_behind; // birth if neighbors behind >= this
+		int death_min_nbors_behind; // death if neighbors behind < this
+		int split_min_room_nbors_ahead; // split if room neighbors ahead >= this
+		int split_min_outer_infl_nbors; // OUTER_INFL_NBORS_THRESHOLD
+		int damage_per_cell;
+	};
+	static Params makeParams(int move_x, int move_y, float birth_thd, float death_thd,
+		float room_nbors_ahead_thd, int outer_infl_nbors_thd, int damage_per_cell);
+	// Compute rows [row_begin, row_end) of the next generation (torus wrapping)
+	static void stepRows(const uint8_t* in, uint8_t* out, size_t cols, size_t rows,
+		size_t row_begin, size_t row_end, const Params& p, Kernel k);
+	// Compute the tile [col_begin, col_end) x [row_begin, row_end), tiles may be stepped in parallel
+	static void stepTile(const uint8_t* in, uint8_t* out, size_t cols, size_t rows,
+		size_t col_begin, size_t col_end, size_t row_begin, size_t row_end, const Params& p, Kernel k);
+	static void step(const uint8_t* in, uint8_t* out, size_t cols, size_t rows, const Params& p, Kernel k);
+	static Kernel getBestKernel(); // widest kernel this build supports
+	static const char* getKernelName(Kernel k);
+private:
+	static int minCount(float thd, float divisor, bool inclusive);
+	static void stepCell(const uint8_t* in, uint8_t* out, size_t cols, size_t rows,
+		size_t col, size_t row, const Params& p);
+};
+
+#endif
\ No newline at end of file
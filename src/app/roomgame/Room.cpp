@@ -1,11 +1,14 @@
 #include "Room.h"
+#include <algorithm>
 #include "InteractiveGrid.h"
+#include "BakedRoom.h"
 
 Room::Room(GridCell* leftLowerCorner, GridCell* rightUpperCorner, InteractiveGrid* grid) {
 	leftLowerCorner_ = leftLowerCorner;
 	rightUpperCorner_ = rightUpperCorner;
 	grid_ = grid;
 	isFinished_ = false;
+	baked_room_ = 0;
 }
 
 Room::~Room() {
@@ -13,6 +16,21 @@ Room::~Room() {
 }
 
 void Room::clear() {
+	if (isFinished_) {
+		// Baked geometry refers to the ranges, release it first
+		if (baked_room_) baked_room_->release();
+		baked_room_ = 0;
+		// One range per mesh instead of one instance per cell
+		for (RoomSegmentMesh::InstanceBufferRange& r : mesh_instances_)
+			r.mesh_->removeRoomOrderedRange(r.instance_id_);
+		mesh_instances_.clear();
+		grid_->forEachCellInRange(leftLowerCorner_, rightUpperCorner_, [&](GridCell* cell) {
+			RoomSegmentMesh::InstanceBufferRange r = cell->getMeshInstance();
+			if (r.mesh_ && r.mesh_->isRoomOrdered(r))
+				cell->setMeshInstance(RoomSegmentMesh::InstanceBufferRange());
+		});
+		isFinished_ = false;
+	}
 	grid_->forEachCellInRange(leftLowerCorner_, rightUpperCorner_, [&](GridCell* cell) {
 		grid_->buildAt(cell->getCol(), cell->getRow(), GridCell::BuildState::EMPTY);
 	});
@@ -39,18 +57,43 @@ size_t Room::getRowSize() {
 }
 
 void Room::finish() {
+	if (isFinished_) return;
 	isFinished_ = true;
-	//TODO Move mesh instances from unordered to room-ordered buffers (for each mesh that is part of the room)
-	// 1) Get instance buffer range for each cell of this room
-	// 2) Copy instance to ordered buffer
-	// 3) Remove instance from unordered buffer
-	// 4) Update cell's mesh instance buffer range
-	// 5) Get the whole ordered buffer range and push into mesh_instances_ vector
-	// 6) Prevent growing/shrinking/spanning of finished rooms
-	// 7) Clearing a finished room should update build state for each cell but remove only 1 buffer range in the ordered buffer! How to do this?
+	// Collect the unordered instances of this room per mesh (cells in row order)
+	std::vector<RoomSegmentMesh*> meshes;
+	std::vector<std::vector<GridCell*>> cells_per_mesh;
 	grid_->forEachCellInRange(leftLowerCorner_, rightUpperCorner_, [&](GridCell* cell) {
-		RoomSegmentMesh::InstanceBufferRange bufferRange = cell->getMeshInstance();
+		RoomSegmentMesh::InstanceBufferRange r = cell->getMeshInstance();
+		if (!r.mesh_ || r.mesh_->isRoomOrdered(r)) return;
+		size_t m = std::find(meshes.begin(), meshes.end(), r.mesh_) - meshes.begin();
+		if (m == meshes.size()) {
+			meshes.push_back(r.mesh_);
+			cells_per_mesh.push_back(std::vector<GridCell*>());
+		}
+		cells_per_mesh[m].push_back(cell);
 	});
+	// Move them into one contiguous range per mesh and point the cells there
+	for (size_t m = 0; m < meshes.size(); m++) {
+		std::vector<int> ids;
+		for (GridCell* cell : cells_per_mesh[m])
+			ids.push_back(cell->getMeshInstance().instance_id_);
+		RoomSegmentMesh::InstanceBufferRange range = meshes[m]->moveInstancesToRoomOrderedBuffer(ids);
+		for (size_t i = 0; i < cells_per_mesh[m].size(); i++) {
+			RoomSegmentMesh::InstanceBufferRange cell_range = range;
+			cell_range.offset_instances_ = (int)i;
+			cell_range.num_instances_ = 1;
+			cells_per_mesh[m][i]->setMeshInstance(cell_range);
+		}
+		mesh_instances_.push_back(range);
+	}
+}
+
+const std::vector<RoomSegmentMesh::InstanceBufferRange>& Room::getMeshInstances() {
+	return mesh_instances_;
+}
+
+void Room::setBakedRoom(BakedRoom* baked_room) {
+	baked_room_ = baked_room;
 }
 
 bool Room::growToEast(size_t dist) {
@@ -328,15 +371,8 @@ bool Room::spanFromTo(GridCell* startCell, GridCell* endCell) {
 			leftUpperCorner = grid_->getCellAt(endCell->getCol(), startCell->getRow());
 		}
 	}
-	// Test collision by brute force
-	bool collision = false;
-	grid_->forEachCellInRange(leftLowerCorner, rightUpperCorner, [&](GridCell* cell, bool* found) {
-		if (cell->getBuildState() != GridCell::BuildState::EMPTY) {
-			collision = true;
-			*found = true;
-		}
-	});
-	if (collision) return false;
+	// Test collision on the occupancy bitsets
+	if (!grid_->isRectEmpty(leftLowerCorner, rightUpperCorner)) return false;
 	leftLowerCorner_ = leftLowerCorner;
 	rightUpperCorner_ = rightUpperCorner;
 	// Test room min size
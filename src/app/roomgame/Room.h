@@ -4,6 +4,7 @@
 #include "GridCell.h"
 
 class InteractiveGrid;
+class BakedRoom;
 
 class Room {
 	GridCell* leftLowerCorner_;
@@ -11,6 +12,7 @@ class Room {
 	InteractiveGrid* grid_;
 	bool isFinished_;
 	std::vector<RoomSegmentMesh::InstanceBufferRange> mesh_instances_;
+	BakedRoom* baked_room_; // owned by the mesh pool
 public:
 	static const size_t MIN_SIZE = 2;
 	Room(GridCell* leftLowerCorner, GridCell* rightUpperCorner, InteractiveGrid* grid);
@@ -18,7 +20,10 @@ public:
 	void clear();
 	void invalidate();
 	bool isValid();
+	// Moves the mesh instances of all cells into one range per mesh
 	void finish();
+	const std::vector<RoomSegmentMesh::InstanceBufferRange>& getMeshInstances();
+	void setBakedRoom(BakedRoom* baked_room);
 	size_t getColSize();
 	size_t getRowSize();
 
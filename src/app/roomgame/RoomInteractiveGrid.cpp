@@ -35,6 +35,7 @@ void RoomInteractiveGrid::onRelease(int touchID) {
 				if (room->isValid()) {
 					// Finish room
 					room->finish();
+					onRoomFinished(room);
 					rooms_.push_back(room);
 				}
 				else {
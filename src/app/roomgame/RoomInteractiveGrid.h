@@ -6,6 +6,9 @@
 
 class RoomInteractiveGrid : public InteractiveGrid {
 	std::vector<Room*> rooms_;
+protected:
+	// Called after a room was finished and its instances were moved into room ranges
+	virtual void onRoomFinished(Room* room) {}
 public:
 	RoomInteractiveGrid(size_t columns, size_t rows, float height);
 	~RoomInteractiveGrid();
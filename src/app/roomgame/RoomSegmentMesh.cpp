@@ -1,9 +1,13 @@
 #include "RoomSegmentMesh.h"
 
 RoomSegmentMesh::InstanceBuffer::InstanceBuffer(size_t pool_allocation_bytes) :
-	pool_allocation_bytes_(pool_allocation_bytes),
 	num_instances_(0),
-	num_reallocations_(1)
+	pool_allocation_bytes_(pool_allocation_bytes),
+	capacity_bytes_(pool_allocation_bytes),
+	num_reallocations_(0),
+	high_water_instances_(0),
+	base_bytes_(0),
+	shared_(false)
 {
 	glGenBuffers(1, &id_);
 	glBindBuffer(GL_ARRAY_BUFFER, id_);
@@ -11,142 +15,280 @@ RoomSegmentMesh::InstanceBuffer::InstanceBuffer(size_t pool_allocation_bytes) :
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+void RoomSegmentMesh::InstanceBuffer::grow(size_t min_bytes) {
+	size_t bytes = (capacity_bytes_ > 0) ? capacity_bytes_ : pool_allocation_bytes_;
+	while (bytes < min_bytes) bytes *= 2;
+	if (bytes == capacity_bytes_) return;
+	capacity_bytes_ = bytes;
+	num_reallocations_++;
+	// New storage for the same buffer name (no copy, caller uploads the content)
+	glBindBuffer(GL_ARRAY_BUFFER, id_);
+	glBufferData(GL_ARRAY_BUFFER, capacity_bytes_, (GLvoid*)0, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 RoomSegmentMesh::RoomSegmentMesh(viscom::Mesh* mesh, viscom::GPUProgram* program, size_t pool_allocation_bytes) :
-	viscom::MeshRenderable(mesh, Vertex::CreateVertexBuffer(mesh), program), // Fill vertex buffer
-	room_ordered_buffer_(pool_allocation_bytes),
+	viscom::MeshRenderable(mesh, 0, program), // geometry is packed into the pool's vertex buffer
 	unordered_buffer_(pool_allocation_bytes),
-	next_free_offset_(0), last_free_offset_(0)
+	unordered_dirty_(4),
+	tile_first_slot_(2, 0)
 {
-	// Create VAO and connect vertex buffer
-	NotifyRecompiledShader<Vertex>(program);
-	// Connect instance buffers
-	glBindVertexArray(vao_);
-	//glBindBuffer(GL_ARRAY_BUFFER, room_ordered_buffer_.id_);
-	//Instance::setAttribPointer();
-	glBindBuffer(GL_ARRAY_BUFFER, unordered_buffer_.id_);
-	Instance::setAttribPointer();
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 RoomSegmentMesh::~RoomSegmentMesh() {
-	glDeleteBuffers(1, &room_ordered_buffer_.id_);
-	glDeleteBuffers(1, &unordered_buffer_.id_);
-	while (next_free_offset_) {
-		NextFreeOffsetQueueElem* tmp = next_free_offset_->el_;
-		delete next_free_offset_;
-		next_free_offset_ = tmp;
+	if (!unordered_buffer_.shared_) glDeleteBuffers(1, &unordered_buffer_.id_);
+}
+
+void RoomSegmentMesh::placeUnorderedBuffer(GLuint id, size_t base_bytes, size_t capacity_bytes) {
+	if (!unordered_buffer_.shared_) glDeleteBuffers(1, &unordered_buffer_.id_);
+	if (unordered_buffer_.shared_ && capacity_bytes != unordered_buffer_.capacity_bytes_)
+		unordered_buffer_.num_reallocations_++;
+	unordered_buffer_.id_ = id;
+	unordered_buffer_.base_bytes_ = base_bytes;
+	unordered_buffer_.capacity_bytes_ = capacity_bytes;
+	unordered_buffer_.shared_ = true;
+	unordered_dirty_.add(0, unordered_instances_.size());
+}
+
+size_t RoomSegmentMesh::getUnorderedBytes() {
+	return unordered_instances_.size() * sizeof(Instance);
+}
+
+void RoomSegmentMesh::setTileLayout(const TileLayout& layout) {
+	if (layout == tile_layout_) return;
+	tile_layout_ = layout;
+	// Counting sort by tile
+	tile_first_slot_.assign(layout.num_tiles + 1, 0);
+	for (const Instance& i : unordered_instances_) tile_first_slot_[layout.getTile(i.getCellIndex()) + 1]++;
+	for (size_t t = 0; t < layout.num_tiles; t++) tile_first_slot_[t + 1] += tile_first_slot_[t];
+	std::vector<int> next_slot(tile_first_slot_.begin(), tile_first_slot_.end() - 1);
+	std::vector<Instance> instances(unordered_instances_.size());
+	std::vector<int> ids(unordered_id_of_slot_.size());
+	for (size_t slot = 0; slot < unordered_instances_.size(); slot++) {
+		int to = next_slot[layout.getTile(unordered_instances_[slot].getCellIndex())]++;
+		instances[to] = unordered_instances_[slot];
+		ids[to] = unordered_id_of_slot_[slot];
+		unordered_slot_of_id_[ids[to]] = to;
 	}
+	unordered_instances_.swap(instances);
+	unordered_id_of_slot_.swap(ids);
+	unordered_dirty_.add(0, unordered_instances_.size());
+}
+
+const std::vector<int>& RoomSegmentMesh::getTileFirstSlots() {
+	return tile_first_slot_;
+}
+
+void RoomSegmentMesh::moveUnorderedInstance(int from_slot, int to_slot) {
+	int id = unordered_id_of_slot_[from_slot];
+	unordered_instances_[to_slot] = unordered_instances_[from_slot];
+	unordered_id_of_slot_[to_slot] = id;
+	unordered_slot_of_id_[id] = to_slot;
+	unordered_dirty_.add(to_slot);
 }
 
 RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::addInstanceUnordered(Instance i) {
-	int next_free_offset;
-	if (!next_free_offset_) next_free_offset = unordered_buffer_.num_instances_;
+	int id;
+	if (free_instance_ids_.empty()) {
+		id = (int)unordered_slot_of_id_.size();
+		unordered_slot_of_id_.push_back(-1);
+	}
 	else {
-		next_free_offset = next_free_offset_->offset_;
-		NextFreeOffsetQueueElem* tmp = next_free_offset_->el_;
-		delete next_free_offset_;
-		next_free_offset_ = tmp;
+		id = free_instance_ids_.back();
+		free_instance_ids_.pop_back();
 	}
-	if ((next_free_offset + 1) * sizeof(Instance) > unordered_buffer_.pool_allocation_bytes_ * unordered_buffer_.num_reallocations_) {
-	/*if ((unordered_buffer_.num_instances_+1) * sizeof(Instance) > unordered_buffer_.pool_allocation_bytes_ * unordered_buffer_.num_reallocations_) {*/
-		// Realloc and copy
-		glBindBuffer(GL_COPY_READ_BUFFER, unordered_buffer_.id_);
-		GLuint tmpBuffer;
-		glGenBuffers(1, &tmpBuffer);
-		glBindBuffer(GL_COPY_WRITE_BUFFER, tmpBuffer);
-		unordered_buffer_.num_reallocations_++;
-		glBufferData(GL_COPY_WRITE_BUFFER, unordered_buffer_.pool_allocation_bytes_ * unordered_buffer_.num_reallocations_, 0, GL_STATIC_COPY);
-		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, unordered_buffer_.num_instances_ * sizeof(Instance));
-		// THIS IS WHAT MAKES REALLOCATION APPROACH ***UGLY***:
-		glDeleteBuffers(1, &unordered_buffer_.id_); // Delete old instance buffer
-		glDeleteVertexArrays(1, &vao_); // Delete old VAO
-		NotifyRecompiledShader<Vertex>(drawProgram_); // Create new VAO and connect old vertex buffer
-		// Connect new instance buffer
-		unordered_buffer_.id_ = tmpBuffer;
-		glBindVertexArray(vao_);
-		glBindBuffer(GL_ARRAY_BUFFER, unordered_buffer_.id_);
-		Instance::setAttribPointer();
+	// Open a slot at the end of the tile: each following tile moves its first instance behind its last
+	size_t tile = tile_layout_.getTile(i.getCellIndex());
+	int slot = unordered_buffer_.num_instances_;
+	unordered_instances_.push_back(Instance());
+	unordered_id_of_slot_.push_back(-1);
+	for (size_t t = tile_layout_.num_tiles - 1; t > tile; t--) {
+		int first = tile_first_slot_[t];
+		if (first != slot) moveUnorderedInstance(first, slot);
+		slot = first;
+		tile_first_slot_[t]++;
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, unordered_buffer_.id_);
-	glBufferSubData(GL_ARRAY_BUFFER, next_free_offset * sizeof(Instance), sizeof(Instance), &i);
-	/*glBufferSubData(GL_ARRAY_BUFFER, unordered_buffer_.num_instances_ * sizeof(Instance), sizeof(Instance), &data);*/
+	tile_first_slot_[tile_layout_.num_tiles]++;
+	unordered_instances_[slot] = i;
+	unordered_id_of_slot_[slot] = id;
+	unordered_slot_of_id_[id] = slot;
+	unordered_dirty_.add(slot);
+	unordered_buffer_.num_instances_++;
+	if (unordered_buffer_.num_instances_ > unordered_buffer_.high_water_instances_)
+		unordered_buffer_.high_water_instances_ = unordered_buffer_.num_instances_;
 	InstanceBufferRange r;
-	r.buffer_ = &unordered_buffer_;
 	r.mesh_ = this;
 	r.num_instances_ = 1;
-	r.offset_instances_ = next_free_offset;
-	/*r.offset_instances_ = unordered_buffer_.num_instances_;*/
-	if (next_free_offset == unordered_buffer_.num_instances_)
-		unordered_buffer_.num_instances_++;
+	r.offset_instances_ = slot; // only valid until the next edit, use the id
+	r.instance_id_ = id;
 	return r;
 }
 
-void RoomSegmentMesh::removeInstanceUnordered(int offset_instances) {
-	if (offset_instances == unordered_buffer_.num_instances_ - 1) {
-		unordered_buffer_.num_instances_--;
+void RoomSegmentMesh::removeInstanceUnordered(int instance_id) {
+	if (instance_id < 0 || (size_t)instance_id >= unordered_slot_of_id_.size()) return;
+	int slot = unordered_slot_of_id_[instance_id];
+	if (slot < 0) return;
+	// Fill the hole with the last instance of the tile, then each following tile
+	// moves its last instance into the hole in front of it
+	size_t tile = tile_layout_.getTile(unordered_instances_[slot].getCellIndex());
+	for (size_t t = tile; t < tile_layout_.num_tiles; t++) {
+		int last = tile_first_slot_[t + 1] - 1;
+		if (last != slot) moveUnorderedInstance(last, slot);
+		slot = last;
+		if (t > tile) tile_first_slot_[t]--;
+	}
+	tile_first_slot_[tile_layout_.num_tiles]--;
+	unordered_instances_.pop_back();
+	unordered_id_of_slot_.pop_back();
+	unordered_slot_of_id_[instance_id] = -1;
+	free_instance_ids_.push_back(instance_id);
+	unordered_buffer_.num_instances_--;
+}
+
+RoomSegmentMesh::Instance* RoomSegmentMesh::getInstance(const InstanceBufferRange& r) {
+	if (isRoomOrdered(r)) {
+		if (r.instance_id_ < 0 || (size_t)r.instance_id_ >= room_ranges_.size()) return 0;
+		const RoomRange& range = room_ranges_[r.instance_id_];
+		if (r.offset_instances_ < 0 || r.offset_instances_ >= range.num_instances_) return 0;
+		return &room_ordered_instances_[range.offset_instances_ + r.offset_instances_];
+	}
+	if (r.instance_id_ < 0 || (size_t)r.instance_id_ >= unordered_slot_of_id_.size()) return 0;
+	int slot = unordered_slot_of_id_[r.instance_id_];
+	if (slot < 0) return 0;
+	return &unordered_instances_[slot];
+}
+
+void RoomSegmentMesh::removeInstance(const InstanceBufferRange& r) {
+	if (!isRoomOrdered(r)) {
+		removeInstanceUnordered(r.instance_id_);
 		return;
 	}
-	if (!next_free_offset_) {
-		next_free_offset_ = new NextFreeOffsetQueueElem(offset_instances);
-		last_free_offset_ = next_free_offset_;
+	// Room ranges stay contiguous, a single removed instance is hidden
+	Instance* i = getInstance(r);
+	if (!i) return;
+	*i = Instance();
+	room_ranges_[r.instance_id_].edited_ = true; // re-baked
+}
+
+void RoomSegmentMesh::updateInstanceHealth(const InstanceBufferRange& r, int h) {
+	Instance* i = getInstance(r);
+	if (!i || i->getHealth() == h) return;
+	i->setHealth(h); // one word to upload
+	if (isRoomOrdered(r)) room_ranges_[r.instance_id_].edited_ = true; // re-baked
+	else unordered_dirty_.add(i - unordered_instances_.data());
+}
+
+bool RoomSegmentMesh::isRoomOrdered(const InstanceBufferRange& r) {
+	return r.room_ordered_;
+}
+
+size_t RoomSegmentMesh::commitInstances(StreamingBuffer* upload_buffer) {
+	if (unordered_dirty_.isEmpty()) return 0;
+	size_t bytes = unordered_instances_.size() * sizeof(Instance);
+	InstanceBuffer& buffer = unordered_buffer_;
+	if (bytes > buffer.capacity_bytes_ && !buffer.shared_) { // shared slices are grown by the pool
+		// Regrown buffer is filled from the CPU copy, so all edits are included
+		buffer.grow(bytes);
+		upload_buffer->upload(buffer.id_, 0, unordered_instances_.data(), bytes);
+		unordered_dirty_.clear();
+		return 1;
+	}
+	size_t num_uploads = unordered_dirty_.flush([&](size_t begin, size_t end) {
+		if (end > unordered_instances_.size()) end = unordered_instances_.size(); // removed meanwhile
+		if (end * sizeof(Instance) > buffer.capacity_bytes_) end = buffer.capacity_bytes_ / sizeof(Instance);
+		if (begin >= end) return;
+		upload_buffer->upload(buffer.id_, buffer.base_bytes_ + begin * sizeof(Instance),
+			&unordered_instances_[begin], (end - begin) * sizeof(Instance));
+	});
+	return num_uploads;
+}
+
+RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::moveInstancesToRoomOrderedBuffer(const std::vector<int>& instance_ids) {
+	int range_id;
+	if (free_room_range_ids_.empty()) {
+		range_id = (int)room_ranges_.size();
+		room_ranges_.push_back(RoomRange());
 	}
 	else {
-		last_free_offset_->el_ = new NextFreeOffsetQueueElem(offset_instances);
-		last_free_offset_ = last_free_offset_->el_;
+		range_id = free_room_range_ids_.back();
+		free_room_range_ids_.pop_back();
+	}
+	RoomRange& range = room_ranges_[range_id];
+	range.offset_instances_ = (int)room_ordered_instances_.size();
+	range.num_instances_ = 0;
+	range.edited_ = false;
+	for (int id : instance_ids) {
+		InstanceBufferRange unordered;
+		unordered.mesh_ = this;
+		unordered.instance_id_ = id;
+		Instance* i = getInstance(unordered);
+		room_ordered_instances_.push_back(i ? *i : Instance());
+		range.num_instances_++;
+		removeInstanceUnordered(id);
 	}
-	Instance zeros;
-	glBindBuffer(GL_ARRAY_BUFFER, unordered_buffer_.id_);
-	glBufferSubData(GL_ARRAY_BUFFER, offset_instances * sizeof(Instance), sizeof(Instance), &zeros);
+	InstanceBufferRange r;
+	r.mesh_ = this;
+	r.room_ordered_ = true;
+	r.offset_instances_ = 0;
+	r.num_instances_ = range.num_instances_;
+	r.instance_id_ = range_id;
+	return r;
 }
 
-RoomSegmentMesh::InstanceBufferRange RoomSegmentMesh::moveInstancesToRoomOrderedBuffer(std::initializer_list<int> offsets) {
-	//TODO copy and remove instances at given offsets
-	return InstanceBufferRange();
+void RoomSegmentMesh::removeRoomOrderedRange(int range_id) {
+	if (range_id < 0 || (size_t)range_id >= room_ranges_.size()) return;
+	RoomRange removed = room_ranges_[range_id];
+	if (removed.num_instances_ == 0) return;
+	room_ordered_instances_.erase(room_ordered_instances_.begin() + removed.offset_instances_,
+		room_ordered_instances_.begin() + removed.offset_instances_ + removed.num_instances_);
+	for (RoomRange& range : room_ranges_)
+		if (range.num_instances_ > 0 && range.offset_instances_ > removed.offset_instances_)
+			range.offset_instances_ -= removed.num_instances_;
+	room_ranges_[range_id].num_instances_ = 0;
+	free_room_range_ids_.push_back(range_id);
 }
 
+const RoomSegmentMesh::Instance* RoomSegmentMesh::getRoomOrderedInstances(int range_id, int& num_instances) {
+	num_instances = 0;
+	if (range_id < 0 || (size_t)range_id >= room_ranges_.size()) return 0;
+	const RoomRange& range = room_ranges_[range_id];
+	if (range.num_instances_ == 0) return 0;
+	num_instances = range.num_instances_;
+	return &room_ordered_instances_[range.offset_instances_];
+}
 
+bool RoomSegmentMesh::takeRoomRangeEdits(int range_id) {
+	if (range_id < 0 || (size_t)range_id >= room_ranges_.size()) return false;
+	bool edited = room_ranges_[range_id].edited_;
+	room_ranges_[range_id].edited_ = false;
+	return edited;
+}
 
-void RoomSegmentMesh::renderAllInstances(std::vector<GLint>* uniformLocations) {
-	if (unordered_buffer_.num_instances_ == 0) return; //TODO Seperately draw unordered and ordered buffers
-	const viscom::SceneMeshNode* root = mesh_->GetRootNode();
-	glBindVertexArray(vao_);
-	renderNode(uniformLocations, root);
+const RoomSegmentMesh::InstanceBuffer& RoomSegmentMesh::getUnorderedBuffer() {
+	return unordered_buffer_;
 }
 
-void RoomSegmentMesh::renderNode(std::vector<GLint>* uniformLocations, const viscom::SceneMeshNode* node, bool overrideBump) {
-	auto localMatrix = node->GetLocalTransform();
-	for (unsigned int i = 0; i < node->GetNumMeshes(); ++i)
-		renderSubMesh(uniformLocations, localMatrix, node->GetMesh(i), overrideBump);
-	for (unsigned int i = 0; i < node->GetNumNodes(); ++i)
-		renderNode(uniformLocations, node->GetChild(i), overrideBump);
+int RoomSegmentMesh::getNumRoomOrderedInstances() {
+	return (int)room_ordered_instances_.size();
 }
 
-void RoomSegmentMesh::renderSubMesh(std::vector<GLint>* uniformLocations, const glm::mat4& localMatrix, const viscom::SubMesh* subMesh, bool overrideBump) {
-	if(uniformLocations->size() > 1)
-		glUniformMatrix4fv(uniformLocations->at(1), 1, GL_FALSE, glm::value_ptr(localMatrix));
-	if(uniformLocations->size() > 2)
-		glUniformMatrix3fv(uniformLocations->at(2), 1, GL_FALSE, glm::value_ptr(glm::inverseTranspose(glm::mat3(localMatrix))));
-	if (subMesh->GetMaterial()->diffuseTex && uniformLocations->size() > 2) {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, subMesh->GetMaterial()->diffuseTex->getTextureId());
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glUniform1i(uniformLocations_[2], 0);
-	}
-	if (subMesh->GetMaterial()->bumpTex && uniformLocations_.size() > 3) {
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, subMesh->GetMaterial()->bumpTex->getTextureId());
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glUniform1i(uniformLocations_[3], 1);
-		if (!overrideBump) glUniform1f(uniformLocations_[4], subMesh->GetMaterial()->bumpMultiplier);
-	}
-	//TODO Seperately draw unordered and ordered buffers
-	glDrawElementsInstanced(GL_TRIANGLES, subMesh->GetNumberOfIndices(), GL_UNSIGNED_INT,
-		(static_cast<char*> (nullptr)) + (subMesh->GetIndexOffset() * sizeof(unsigned int)), unordered_buffer_.num_instances_);
+const std::vector<RoomSegmentMesh::Instance>& RoomSegmentMesh::getUnorderedInstances() {
+	return unordered_instances_;
+}
+
+const std::vector<RoomSegmentMesh::Instance>& RoomSegmentMesh::getRoomOrderedInstances() {
+	return room_ordered_instances_;
+}
+
+const viscom::Mesh* RoomSegmentMesh::getMesh() {
+	return mesh_;
+}
+
+void RoomSegmentMesh::setSubMeshMaterials(const std::vector<glm::ivec4>& materials) {
+	sub_mesh_materials_ = materials;
+}
+
+glm::ivec4 RoomSegmentMesh::getSubMeshMaterial(size_t draw_index) {
+	if (draw_index >= sub_mesh_materials_.size()) return glm::ivec4(-1);
+	return sub_mesh_materials_[draw_index];
 }
\ No newline at end of file
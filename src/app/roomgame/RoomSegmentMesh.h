@@ -7,81 +7,156 @@
 #include "core/gfx/Material.h"
 #include "core/gfx/Texture.h"
 #include "../Vertices.h"
+#include "DirtyRanges.h"
+#include "StreamingBuffer.h"
 
 class RoomSegmentMesh : public viscom::MeshRenderable {
 public:
-	typedef viscom::SimpleMeshVertex Vertex; // vertex attribs
+	// Vertex attrib of the pool's packed geometry: index of the sub mesh data
+	static const GLint SUB_MESH_INDEX_LOC = 7;
 	struct InstanceBuffer {
 		GLuint id_;
 		int num_instances_;
-		const size_t pool_allocation_bytes_;
+		const size_t pool_allocation_bytes_; // initial capacity
+		size_t capacity_bytes_;
 		size_t num_reallocations_;
+		int high_water_instances_; // max. number of instances so far
+		size_t base_bytes_; // start of the instances in the buffer
+		bool shared_; // slice of a buffer owned by the mesh pool
 		InstanceBuffer(size_t pool_allocation_bytes);
+		// Grows capacity geometrically to at least min_bytes, old content is lost
+		// The buffer name stays the same, so VAOs that source it stay valid
+		void grow(size_t min_bytes);
 	};
-	struct Instance { // instance attribs
+	// Placement of the cells, instance transforms are derived from it (on the GPU in renderMeshInstance.vert)
+	struct GridGeometry {
 		glm::vec3 translation = glm::vec3(0);
-		GLfloat scale = 0.0f;
-		GLint buildState = 0;
-		GLint health = 0;
-		static const void updateHealth(GLuint buffer, int offset_instances, int h) {
-			glBindBuffer(GL_ARRAY_BUFFER, buffer);
-			glBufferSubData(GL_ARRAY_BUFFER,
-				(offset_instances + 1) * sizeof(Instance) - sizeof(health),
-				sizeof(health), &h);
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		GLfloat cell_size = 0.0f;
+		GLuint columns = 0;
+	};
+	// Tiles of the grid as in GridTileTree (row-major, TILE_CELLS x TILE_CELLS cells)
+	struct TileLayout {
+		GLuint columns = 0; // of the grid, 0 for one tile
+		GLuint tile_cells = 1;
+		GLuint tile_columns = 1;
+		GLuint num_tiles = 1;
+		size_t getTile(GLuint cell_index) const {
+			if (columns == 0) return 0;
+			size_t tile = (cell_index / columns / tile_cells) * tile_columns + (cell_index % columns) / tile_cells;
+			return (tile < num_tiles) ? tile : num_tiles - 1;
+		}
+		bool operator==(const TileLayout& o) const {
+			return columns == o.columns && tile_cells == o.tile_cells && tile_columns == o.tile_columns && num_tiles == o.num_tiles;
+		}
+	};
+	struct Instance { // instance attrib, one packed word
+		// Cell index (row * columns + col), build state and health
+		static const GLuint CELL_BITS = 20;
+		static const GLuint STATE_BITS = 4;
+		static const GLuint HEALTH_SHIFT = CELL_BITS + STATE_BITS;
+		GLuint data = 0; // build state EMPTY means hidden
+		Instance() {}
+		Instance(size_t cell_index, GLint build_state, GLint health) {
+			data = ((GLuint)cell_index & ((1u << CELL_BITS) - 1))
+				| (((GLuint)build_state & ((1u << STATE_BITS) - 1)) << CELL_BITS)
+				| ((GLuint)(health & 0xFF) << HEALTH_SHIFT);
+		}
+		GLuint getCellIndex() const { return data & ((1u << CELL_BITS) - 1); }
+		GLint getBuildState() const { return (GLint)((data >> CELL_BITS) & ((1u << STATE_BITS) - 1)); }
+		GLint getHealth() const { return (GLint)(data >> HEALTH_SHIFT); }
+		void setHealth(GLint health) {
+			data = (data & ((1u << HEALTH_SHIFT) - 1)) | ((GLuint)(health & 0xFF) << HEALTH_SHIFT);
 		}
-		static const void setAttribPointer() {
-			GLint transLoc = 3;
-			GLint scaleLoc = 4;
-			GLint buildStateLoc = 5;
-			GLint healthLoc = 6;
-			glEnableVertexAttribArray(transLoc);
-			glEnableVertexAttribArray(scaleLoc);
-			glEnableVertexAttribArray(buildStateLoc);
-			glEnableVertexAttribArray(healthLoc);
-			size_t off = 0;
-			glVertexAttribPointer(transLoc, 3, GL_FLOAT, false, sizeof(Instance), (GLvoid*)off);
-			off += 3 * sizeof(GLfloat);
-			glVertexAttribPointer(scaleLoc, 1, GL_FLOAT, false, sizeof(Instance), (GLvoid*)off);
-			off += sizeof(GLfloat);
-			glVertexAttribIPointer(buildStateLoc, 1, GL_INT, sizeof(Instance), (GLvoid*)off);
-			off += sizeof(GLint);
-			glVertexAttribIPointer(healthLoc, 1, GL_INT, sizeof(Instance), (GLvoid*)off);
-			glVertexAttribDivisor(transLoc, 1);
-			glVertexAttribDivisor(scaleLoc, 1);
-			glVertexAttribDivisor(buildStateLoc, 1);
-			glVertexAttribDivisor(healthLoc, 1);
+		bool isHidden() const { return getBuildState() == 0; }
+		// Same placement as in renderMeshInstance.vert (model extends [-1,1]^3, grid origin at (-1,-1))
+		glm::vec3 getTranslation(const GridGeometry& grid) const {
+			GLuint cell = getCellIndex();
+			glm::vec2 pos = glm::vec2(-1.0f) + glm::vec2(cell % grid.columns, cell / grid.columns) * grid.cell_size;
+			return grid.translation + glm::vec3(pos + glm::vec2(0.5f, -0.5f) * grid.cell_size, 0.0f);
+		}
+		GLfloat getScale(const GridGeometry& grid) const {
+			return isHidden() ? 0.0f : grid.cell_size / 2.0f;
+		}
+		// Attribute starts at first_instance of the bound buffer
+		// (GL 3.3 has no base instance, ranged draws move the pointer instead)
+		static void setAttribPointer(size_t first_instance = 0) {
+			GLint dataLoc = 3;
+			glEnableVertexAttribArray(dataLoc);
+			glVertexAttribIPointer(dataLoc, 1, GL_UNSIGNED_INT, sizeof(Instance), (GLvoid*)(first_instance * sizeof(Instance)));
+			glVertexAttribDivisor(dataLoc, 1);
 		}
 	};
 	struct InstanceBufferRange {
 		RoomSegmentMesh* mesh_ = 0;
-		InstanceBuffer* buffer_ = 0;
+		bool room_ordered_ = false;
 		int offset_instances_ = -1;
 		int num_instances_ = -1;
-	};
-	struct NextFreeOffsetQueueElem {
-		int offset_;
-		NextFreeOffsetQueueElem* el_;
-		NextFreeOffsetQueueElem(int off) :
-			offset_(off), el_(0) {}
+		// Unordered: stable handle of the instance (its slot can move)
+		// Room-ordered: id of the room range, offset_instances_ is relative to the range start
+		int instance_id_ = -1;
 	};
 private:
-	InstanceBuffer room_ordered_buffer_;
 	InstanceBuffer unordered_buffer_;
-	NextFreeOffsetQueueElem* next_free_offset_;
-	NextFreeOffsetQueueElem* last_free_offset_;
+	// Edits go to a CPU copy and are uploaded on commit
+	std::vector<Instance> unordered_instances_;
+	DirtyRanges unordered_dirty_;
+	// Unordered instances are kept dense and grouped by tile: tile t owns the slots
+	// [tile_first_slot_[t], tile_first_slot_[t + 1]), so culling copies whole tiles
+	// Adding or removing moves at most one instance per following tile
+	// Instance ids are indirections to slots, so handles survive the moves
+	std::vector<int> unordered_slot_of_id_; // -1 for free ids
+	std::vector<int> unordered_id_of_slot_;
+	std::vector<int> free_instance_ids_;
+	TileLayout tile_layout_;
+	std::vector<int> tile_first_slot_; // one entry per tile and the end
+	void moveUnorderedInstance(int from_slot, int to_slot);
+	// Instances of finished rooms, each room owns a contiguous range per mesh
+	// Ranges are kept dense: removing a range moves all later ranges down
+	// Finished rooms are drawn baked, so these stay on the CPU
+	struct RoomRange {
+		int offset_instances_;
+		int num_instances_; // 0 for free ids
+		bool edited_; // health changed or instance removed since the last bake
+	};
+	std::vector<Instance> room_ordered_instances_;
+	std::vector<RoomRange> room_ranges_;
+	std::vector<int> free_room_range_ids_;
+	// Material layers per sub mesh in draw list order (diffuse array, diffuse layer, bump array, bump layer)
+	std::vector<glm::ivec4> sub_mesh_materials_;
+	Instance* getInstance(const InstanceBufferRange& r);
 public:
 	RoomSegmentMesh(viscom::Mesh* mesh, viscom::GPUProgram* program, size_t pool_allocation_bytes);
 	~RoomSegmentMesh();
+	// Moves the unordered instances into a slice of a shared buffer (all uploaded on the next commit)
+	void placeUnorderedBuffer(GLuint id, size_t base_bytes, size_t capacity_bytes);
+	size_t getUnorderedBytes();
+	// Regroups the unordered instances (all uploaded on the next commit)
+	void setTileLayout(const TileLayout& layout);
+	const std::vector<int>& getTileFirstSlots();
 	InstanceBufferRange addInstanceUnordered(Instance);
-	void removeInstanceUnordered(int offset_instances);
-	InstanceBufferRange moveInstancesToRoomOrderedBuffer(std::initializer_list<int> offsets);
-	void renderAllInstances(std::vector<GLint>* uniformLocations);
-private:
-	void renderNode(std::vector<GLint>* uniformLocations,
-		const viscom::SceneMeshNode* node, bool overrideBump=false);
-	void renderSubMesh(std::vector<GLint>* uniformLocations,
-		const glm::mat4& modelMatrix, const viscom::SubMesh* subMesh, bool overrideBump=false);
+	void removeInstanceUnordered(int instance_id);
+	// Takes unordered or room-ordered handles of single instances
+	void removeInstance(const InstanceBufferRange& r);
+	void updateInstanceHealth(const InstanceBufferRange& r, int h);
+	bool isRoomOrdered(const InstanceBufferRange& r);
+	// Upload all edits of unordered instances since the last commit, returns number of uploads
+	size_t commitInstances(StreamingBuffer* upload_buffer);
+	// Moves unordered instances into one new room range, in the given order
+	InstanceBufferRange moveInstancesToRoomOrderedBuffer(const std::vector<int>& instance_ids);
+	void removeRoomOrderedRange(int range_id);
+	// Instances of a room range, for baking
+	const Instance* getRoomOrderedInstances(int range_id, int& num_instances);
+	// Returns whether the range was edited since the last call
+	bool takeRoomRangeEdits(int range_id);
+	const InstanceBuffer& getUnorderedBuffer();
+	int getNumRoomOrderedInstances();
+	// CPU copies of the instances (hidden instances have scale 0)
+	const std::vector<Instance>& getUnorderedInstances();
+	const std::vector<Instance>& getRoomOrderedInstances();
+	const viscom::Mesh* getMesh();
+	// Set by the pool when it packs the meshes into its texture arrays
+	void setSubMeshMaterials(const std::vector<glm::ivec4>& materials);
+	glm::ivec4 getSubMeshMaterial(size_t draw_index); // -1 for no texture
 };
 
 #endif
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "RoomSegmentMeshPool.h"
+#include <algorithm>
+#include <limits>
 
 RoomSegmentMeshPool::RoomSegmentMeshPool(const size_t MAX_INSTANCES) :
 	POOL_ALLOC_BYTES_CORNERS((MAX_INSTANCES / 128 + 1) * sizeof(RoomSegmentMesh::Instance)),
@@ -8,12 +10,59 @@ RoomSegmentMeshPool::RoomSegmentMeshPool(const size_t MAX_INSTANCES) :
 	POOL_ALLOC_BYTES_DEFAULT(MAX_INSTANCES * sizeof(RoomSegmentMesh::Instance))
 {
 	shader_ = 0;
+	num_rebakes_ = 0;
+	baked_version_ = 0;
+	is_packed_ = false;
+	use_multi_draw_indirect_ = false;
+	packed_vao_ = 0; // GL objects are created on first use
+	packed_vbo_ = 0;
+	packed_ibo_ = 0;
+	instance_buffer_ = 0;
+	command_buffer_ = 0;
+	sub_mesh_data_buffer_ = 0;
+	sub_mesh_data_texture_ = 0;
+	num_draw_calls_last_pass_ = 0;
+	frame_uniforms_ = FrameUniforms();
+	frame_uniforms_dirty_ = true;
+	frame_uniform_buffer_ = 0;
+	automaton_textures_[0] = 0;
+	automaton_textures_[1] = 0;
+	automaton_sampler_ = 0;
+	num_frame_uniform_uploads_ = 0;
+	upload_buffer_ = 0;
+	tile_tree_dirty_ = true;
+	frustum_culling_ = true;
+	num_instances_last_pass_ = 0;
+	num_drawn_instances_last_pass_ = 0;
+	gpu_driven_outer_influence_ = false;
+	cell_vao_ = 0;
 }
 
 RoomSegmentMeshPool::~RoomSegmentMeshPool() {
 }
 
 void RoomSegmentMeshPool::cleanup() {
+	for (BakedRoom* room : baked_rooms_)
+		delete room;
+	baked_rooms_.clear();
+	if (packed_vao_ != 0) {
+		glDeleteTextures(1, &sub_mesh_data_texture_);
+		glDeleteBuffers(1, &sub_mesh_data_buffer_);
+		glDeleteBuffers(1, &command_buffer_);
+		glDeleteBuffers(1, &instance_buffer_);
+		glDeleteBuffers(1, &packed_ibo_);
+		glDeleteBuffers(1, &packed_vbo_);
+		glDeleteVertexArrays(1, &packed_vao_);
+		glDeleteVertexArrays(1, &cell_vao_);
+		packed_vao_ = 0;
+		cell_vao_ = 0;
+	}
+	material_textures_.clear();
+	is_packed_ = false;
+	if (frame_uniform_buffer_ != 0) glDeleteBuffers(1, &frame_uniform_buffer_);
+	if (automaton_sampler_ != 0) glDeleteSamplers(1, &automaton_sampler_);
+	frame_uniform_buffer_ = 0;
+	automaton_sampler_ = 0;
 	for (GridCell::BuildState i : render_list_)
 		for (RoomSegmentMesh* mesh : meshes_[i])
 			delete mesh;
@@ -37,6 +86,7 @@ void RoomSegmentMeshPool::addMesh(std::vector<GridCell::BuildState> types, std::
 		// Hold the mesh resource in memory as long as the mesh pool lives
 		owned_resources_.insert(mesh);
 	}
+	is_packed_ = false; // repack on next use
 }
 
 void RoomSegmentMeshPool::addMeshVariations(std::vector<GridCell::BuildState> types, std::vector<std::shared_ptr<viscom::Mesh>> mesh_variations) {
@@ -61,53 +111,662 @@ RoomSegmentMesh* RoomSegmentMeshPool::getMeshOfType(GridCell::BuildState type) {
 	return mesh_variations[variation];
 }
 
+BakedRoom* RoomSegmentMeshPool::bakeRoom(const std::vector<RoomSegmentMesh::InstanceBufferRange>& ranges) {
+	preparePackedDraw(); // material layers are assigned when packing
+	BakedRoom* room = new BakedRoom(ranges, grid_geometry_);
+	baked_rooms_.push_back(room);
+	baked_version_++;
+	return room;
+}
+
+size_t RoomSegmentMeshPool::commitInstances() {
+	preparePackedDraw();
+	size_t num_uploads = 0;
+	for (const PackedMesh& p : packed_meshes_) {
+		size_t n = p.mesh->commitInstances(upload_buffer_);
+		if (n > 0) instance_versions_[p.type]++;
+		num_uploads += n;
+	}
+	// Delete rooms released since the last commit, re-bake damaged ones
+	size_t n = 0;
+	for (BakedRoom* room : baked_rooms_) {
+		if (room->isReleased()) {
+			delete room;
+			baked_version_++;
+			continue;
+		}
+		if (room->update()) {
+			num_rebakes_++;
+			num_uploads++;
+			baked_version_++;
+		}
+		baked_rooms_[n++] = room;
+	}
+	baked_rooms_.resize(n);
+	updateDrawCommands();
+	return num_uploads;
+}
+
+size_t RoomSegmentMeshPool::getInstanceVersionExcept(GridCell::BuildState type_not_counted) {
+	// Sum of counters that never decrease, so it changes with any of them
+	size_t version = baked_version_;
+	for (const auto& v : instance_versions_)
+		if (v.first != type_not_counted) version += v.second;
+	return version;
+}
+
+bool RoomSegmentMeshPool::getInstanceBoundsExcept(GridCell::BuildState type_not_counted, viscom::math::AABB3<float>& bounds) {
+	preparePackedDraw();
+	bounds.minmax[0] = glm::vec3(std::numeric_limits<float>::infinity());
+	bounds.minmax[1] = glm::vec3(-std::numeric_limits<float>::infinity());
+	bool found = false;
+	if (grid_geometry_.columns == 0) return false;
+	for (const PackedMesh& p : packed_meshes_) {
+		if (p.type == type_not_counted || p.num_commands == 0) continue;
+		// Baked rooms are made of the room-ordered instances
+		for (const std::vector<RoomSegmentMesh::Instance>* instances : { &p.mesh->getUnorderedInstances(), &p.mesh->getRoomOrderedInstances() }) {
+			for (const RoomSegmentMesh::Instance& i : *instances) {
+				if (i.isHidden()) continue;
+				glm::mat4 model = glm::scale(glm::translate(glm::mat4(1), i.getTranslation(grid_geometry_)), glm::vec3(i.getScale(grid_geometry_)));
+				viscom::math::AABB3<float> b = viscom::math::transformAABB(p.bounds, model);
+				bounds.minmax[0] = glm::min(bounds.minmax[0], b.minmax[0]);
+				bounds.minmax[1] = glm::max(bounds.minmax[1], b.minmax[1]);
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+void RoomSegmentMeshPool::packMeshes() {
+	std::vector<PackedVertex> vertices;
+	std::vector<GLuint> indices;
+	std::vector<glm::vec4> sub_mesh_data; // local matrix columns, material layers
+	packed_meshes_.clear();
+	material_textures_.clear();
+	draw_commands_.clear();
+	std::set<RoomSegmentMesh*> visited; // render list can name a mesh more than once
+	for (GridCell::BuildState type : render_list_) {
+		for (RoomSegmentMesh* mesh : meshes_[type]) {
+			if (!visited.insert(mesh).second) continue;
+			PackedMesh packed;
+			packed.mesh = mesh;
+			packed.type = type;
+			packed.first_command = draw_commands_.size();
+			packed.bounds.minmax[0] = glm::vec3(std::numeric_limits<float>::infinity());
+			packed.bounds.minmax[1] = glm::vec3(-std::numeric_limits<float>::infinity());
+			const viscom::Mesh* m = mesh->getMesh();
+			const std::vector<unsigned int>& mesh_indices = m->GetIndices();
+			float position_scale = PoolVertexFormat::GetPositionScale(m);
+			std::vector<glm::ivec4> materials; // also used by the baked rooms
+			for (const viscom::Mesh::SubMeshDraw& draw : m->GetDrawList()) {
+				GLint sub_mesh_index = (GLint)(sub_mesh_data.size() / SUB_MESH_DATA_TEXELS);
+				const glm::mat4& localMatrix = draw.localMatrix;
+				glm::mat4 packedMatrix = localMatrix * glm::scale(glm::mat4(1), glm::vec3(position_scale));
+				for (int col = 0; col < 4; col++) sub_mesh_data.push_back(packedMatrix[col]);
+				MaterialTextureArrays::Layer diffuse, bump;
+				if (draw.material) {
+					diffuse = material_textures_.addTexture(draw.material->diffuseTex.get());
+					bump = material_textures_.addTexture(draw.material->bumpTex.get());
+				}
+				materials.push_back(glm::ivec4(diffuse.array_index, diffuse.layer, bump.array_index, bump.layer));
+				sub_mesh_data.push_back(glm::vec4(materials.back()));
+				auto first = mesh_indices.begin() + draw.indexOffset;
+				auto last = first + draw.numIndices;
+				// Each sub mesh gets its own copy of the vertices it uses, tagged with its matrix
+				std::vector<unsigned int> used(first, last);
+				std::sort(used.begin(), used.end());
+				used.erase(std::unique(used.begin(), used.end()), used.end());
+				GLuint base = (GLuint)vertices.size();
+				for (unsigned int v : used) {
+					const glm::vec3& position = m->GetVertices()[v];
+					// Instance space position as in renderMeshInstance.vert, for each 90 degree rotation
+					glm::vec2 xy(position.x, -position.z);
+					for (int r = 0; r < 4; r++) {
+						glm::vec3 p = glm::vec3(localMatrix * glm::vec4(xy, position.y, 1));
+						packed.bounds.minmax[0] = glm::min(packed.bounds.minmax[0], p);
+						packed.bounds.minmax[1] = glm::max(packed.bounds.minmax[1], p);
+						xy = glm::vec2(xy.y, -xy.x);
+					}
+					PackedVertex pv;
+					pv.vertex_ = PoolVertexFormat(position, m->GetNormals()[v], glm::vec2(m->GetTexCoords(0)[v]), position_scale);
+					pv.subMeshIndex_ = sub_mesh_index;
+					vertices.push_back(pv);
+				}
+				DrawCommand cmd;
+				cmd.count = (GLuint)(last - first);
+				cmd.instanceCount = 0;
+				cmd.firstIndex = (GLuint)indices.size();
+				cmd.baseVertex = 0;
+				cmd.baseInstance = 0;
+				for (auto it = first; it != last; it++)
+					indices.push_back(base + (GLuint)(std::lower_bound(used.begin(), used.end(), *it) - used.begin()));
+				draw_commands_.push_back(cmd);
+			}
+			packed.num_commands = draw_commands_.size() - packed.first_command;
+			mesh->setSubMeshMaterials(materials);
+			packed_meshes_.push_back(packed);
+		}
+	}
+	if (packed_vao_ == 0) {
+		glGenVertexArrays(1, &packed_vao_);
+		glGenVertexArrays(1, &cell_vao_);
+		glGenBuffers(1, &packed_vbo_);
+		glGenBuffers(1, &packed_ibo_);
+		glGenBuffers(1, &instance_buffer_);
+		glGenBuffers(1, &command_buffer_);
+		glGenBuffers(1, &sub_mesh_data_buffer_);
+		glGenTextures(1, &sub_mesh_data_texture_);
+	}
+	// Vertex and instance attribs
+	glBindVertexArray(packed_vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, packed_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(PackedVertex), vertices.data(), GL_STATIC_DRAW);
+	PoolVertexFormat::SetVertexAttributes(0, 1, 2, sizeof(PackedVertex), offsetof(PackedVertex, vertex_));
+	glEnableVertexAttribArray(RoomSegmentMesh::SUB_MESH_INDEX_LOC);
+	glVertexAttribIPointer(RoomSegmentMesh::SUB_MESH_INDEX_LOC, 1, GL_INT, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, subMeshIndex_));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, packed_ibo_);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_);
+	RoomSegmentMesh::Instance::setAttribPointer();
+	// Same geometry for the automaton cells, the instance is identified by gl_InstanceID
+	glBindVertexArray(cell_vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, packed_vbo_);
+	PoolVertexFormat::SetVertexAttributes(0, 1, 2, sizeof(PackedVertex), offsetof(PackedVertex, vertex_));
+	glEnableVertexAttribArray(RoomSegmentMesh::SUB_MESH_INDEX_LOC);
+	glVertexAttribIPointer(RoomSegmentMesh::SUB_MESH_INDEX_LOC, 1, GL_INT, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, subMeshIndex_));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, packed_ibo_);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// Sub mesh data, SUB_MESH_DATA_TEXELS texels per sub mesh
+	glBindBuffer(GL_TEXTURE_BUFFER, sub_mesh_data_buffer_);
+	glBufferData(GL_TEXTURE_BUFFER, sub_mesh_data.size() * sizeof(glm::vec4), sub_mesh_data.data(), GL_STATIC_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, sub_mesh_data_texture_);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, sub_mesh_data_buffer_);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	material_textures_.build();
+	// Base instance selects the slice of a mesh in the shared instance buffer
+	use_multi_draw_indirect_ = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+	if (use_multi_draw_indirect_) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, draw_commands_.size() * sizeof(DrawCommand), draw_commands_.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	is_packed_ = true;
+	tile_tree_dirty_ = true;
+}
+
+void RoomSegmentMeshPool::layoutInstanceBuffer() {
+	// One slice per mesh, a slice keeps its capacity unless it is too small
+	std::vector<size_t> capacities;
+	size_t total_bytes = 0;
+	for (const PackedMesh& p : packed_meshes_) {
+		const RoomSegmentMesh::InstanceBuffer& buffer = p.mesh->getUnorderedBuffer();
+		size_t bytes = (buffer.capacity_bytes_ > 0) ? buffer.capacity_bytes_ : buffer.pool_allocation_bytes_;
+		while (bytes < p.mesh->getUnorderedBytes()) bytes *= 2;
+		capacities.push_back(bytes);
+		total_bytes += bytes;
+	}
+	// Same buffer name, so the VAOs stay valid, meshes upload all their instances on commit
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_);
+	glBufferData(GL_ARRAY_BUFFER, total_bytes, (GLvoid*)0, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	size_t base_bytes = 0;
+	for (size_t i = 0; i < packed_meshes_.size(); i++) {
+		packed_meshes_[i].mesh->placeUnorderedBuffer(instance_buffer_, base_bytes, capacities[i]);
+		base_bytes += capacities[i];
+	}
+}
+
+void RoomSegmentMeshPool::preparePackedDraw() {
+	if (!is_packed_) {
+		packMeshes();
+		layoutInstanceBuffer();
+		return;
+	}
+	for (const PackedMesh& p : packed_meshes_) {
+		if (p.mesh->getUnorderedBytes() > p.mesh->getUnorderedBuffer().capacity_bytes_) {
+			layoutInstanceBuffer();
+			return;
+		}
+	}
+}
+
+void RoomSegmentMeshPool::updateDrawCommands() {
+	if (!is_packed_) return;
+	// Commands only change with instance counts and slice positions
+	bool changed = false;
+	for (const PackedMesh& p : packed_meshes_) {
+		const RoomSegmentMesh::InstanceBuffer& buffer = p.mesh->getUnorderedBuffer();
+		GLuint count = (GLuint)buffer.num_instances_;
+		GLuint base = (GLuint)(buffer.base_bytes_ / sizeof(RoomSegmentMesh::Instance));
+		for (size_t c = p.first_command; c < p.first_command + p.num_commands; c++) {
+			if (draw_commands_[c].instanceCount == count && draw_commands_[c].baseInstance == base) continue;
+			draw_commands_[c].instanceCount = count;
+			draw_commands_[c].baseInstance = base;
+			changed = true;
+		}
+	}
+	if (changed && use_multi_draw_indirect_) {
+		upload_buffer_->upload(command_buffer_, 0, draw_commands_.data(), draw_commands_.size() * sizeof(DrawCommand));
+	}
+}
+
+bool RoomSegmentMeshPool::cullTiles(glm::mat4& view_projection) {
+	if (tile_tree_dirty_ && is_packed_ && grid_geometry_.cell_size > 0.0f && !packed_meshes_.empty()) {
+		// Bounds of any instance at the first cell, the tiles move it by the cell size
+		viscom::math::AABB3<float> instance_bounds = packed_meshes_[0].bounds;
+		for (const PackedMesh& p : packed_meshes_) {
+			instance_bounds.minmax[0] = glm::min(instance_bounds.minmax[0], p.bounds.minmax[0]);
+			instance_bounds.minmax[1] = glm::max(instance_bounds.minmax[1], p.bounds.minmax[1]);
+		}
+		RoomSegmentMesh::Instance first_cell_instance(0, GridCell::BuildState::INSIDE_ROOM, 0);
+		glm::vec3 translation = first_cell_instance.getTranslation(grid_geometry_);
+		GLfloat scale = first_cell_instance.getScale(grid_geometry_);
+		viscom::math::AABB3<float> first_cell;
+		first_cell.minmax[0] = translation + scale * instance_bounds.minmax[0];
+		first_cell.minmax[1] = translation + scale * instance_bounds.minmax[1];
+		size_t rows = (size_t)(frame_uniforms_.gridDimensions.y / grid_geometry_.cell_size + 0.5f);
+		tile_tree_.build(grid_geometry_.columns, rows, first_cell, glm::vec2(grid_geometry_.cell_size));
+		tile_tree_dirty_ = false;
+		// Meshes group their instances by these tiles
+		RoomSegmentMesh::TileLayout layout;
+		layout.columns = grid_geometry_.columns;
+		layout.tile_cells = (GLuint)GridTileTree::TILE_CELLS;
+		layout.tile_columns = (GLuint)tile_tree_.getTileColumns();
+		layout.num_tiles = (GLuint)std::max(tile_tree_.getNumTiles(), (size_t)1);
+		for (const PackedMesh& p : packed_meshes_) p.mesh->setTileLayout(layout);
+	}
+	if (!tile_tree_.isBuilt()) return false;
+	if (!frustum_culling_) {
+		tile_tree_.setAllVisible();
+		return false;
+	}
+	tile_tree_.cull(viscom::math::extractFrustum<float>(view_projection));
+	return !tile_tree_.isAllVisible();
+}
+
+bool RoomSegmentMeshPool::cullInstances(bool skip_type, GridCell::BuildState type_not_to_render, GLintptr& instance_offset, GLintptr& command_offset) {
+	culled_instances_.clear();
+	culled_commands_ = draw_commands_;
+	glm::ivec4 tiles = tile_tree_.getVisibleTileRect();
+	size_t tile_columns = tile_tree_.getTileColumns();
+	for (const PackedMesh& p : packed_meshes_) {
+		GLuint base = (GLuint)culled_instances_.size();
+		const std::vector<int>& first_slot = p.mesh->getTileFirstSlots();
+		const std::vector<RoomSegmentMesh::Instance>& instances = p.mesh->getUnorderedInstances();
+		if (!skip_type || p.type != type_not_to_render) {
+			if (first_slot.size() == tile_tree_.getNumTiles() + 1) {
+				// Slot ranges of the visible tiles, adjacent tiles are one copy
+				int begin = 0;
+				int end = 0;
+				for (int y = tiles.y; y < tiles.y + tiles.w; y++) {
+					for (int x = tiles.x; x < tiles.x + tiles.z; x++) {
+						size_t tile = y * tile_columns + x;
+						if (!tile_tree_.isTileVisible(tile) || first_slot[tile] == first_slot[tile + 1]) continue;
+						if (first_slot[tile] != end) {
+							culled_instances_.insert(culled_instances_.end(), instances.begin() + begin, instances.begin() + end);
+							begin = first_slot[tile];
+						}
+						end = first_slot[tile + 1];
+					}
+				}
+				culled_instances_.insert(culled_instances_.end(), instances.begin() + begin, instances.begin() + end);
+			}
+			else {
+				// Not grouped by these tiles yet
+				for (const RoomSegmentMesh::Instance& i : instances)
+					if (!i.isHidden() && tile_tree_.isCellVisible(i.getCellIndex())) culled_instances_.push_back(i);
+			}
+		}
+		for (size_t c = p.first_command; c < p.first_command + p.num_commands; c++) {
+			culled_commands_[c].instanceCount = (GLuint)culled_instances_.size() - base;
+			culled_commands_[c].baseInstance = base;
+		}
+	}
+	instance_offset = 0;
+	command_offset = 0;
+	if (!culled_instances_.empty()) {
+		instance_offset = upload_buffer_->stream(culled_instances_.data(), culled_instances_.size() * sizeof(RoomSegmentMesh::Instance));
+		if (instance_offset < 0) return false;
+	}
+	if (use_multi_draw_indirect_ && !culled_commands_.empty()) {
+		command_offset = upload_buffer_->stream(culled_commands_.data(), culled_commands_.size() * sizeof(DrawCommand));
+		if (command_offset < 0) return false;
+	}
+	return true;
+}
+
+void RoomSegmentMeshPool::renderPacked(bool culled, bool skip_type, GridCell::BuildState type_not_to_render) {
+	preparePackedDraw();
+	updateDrawCommands();
+	// Instances and commands of this pass, culled ones are read from the upload buffer
+	GLuint instance_source = instance_buffer_;
+	GLintptr instance_offset = 0;
+	GLuint command_source = command_buffer_;
+	GLintptr command_offset = 0;
+	const std::vector<DrawCommand>* commands = &draw_commands_;
+	if (culled && cullInstances(skip_type, type_not_to_render, instance_offset, command_offset)) {
+		instance_source = upload_buffer_->getBufferId();
+		if (use_multi_draw_indirect_) command_source = upload_buffer_->getBufferId();
+		commands = &culled_commands_;
+	}
+	else culled = false;
+	glBindVertexArray(packed_vao_);
+	// Same texture state for all meshes (sampler units are fixed in setupProgram)
+	glActiveTexture(GL_TEXTURE0 + SUB_MESH_DATA_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, sub_mesh_data_texture_);
+	material_textures_.bind(MATERIAL_TEXTURES_UNIT);
+	num_draw_calls_last_pass_ = 0;
+	num_instances_last_pass_ = 0;
+	num_drawn_instances_last_pass_ = 0;
+	for (const PackedMesh& p : packed_meshes_) {
+		if ((skip_type && p.type == type_not_to_render) || p.num_commands == 0) continue;
+		num_instances_last_pass_ += draw_commands_[p.first_command].instanceCount;
+		num_drawn_instances_last_pass_ += (*commands)[p.first_command].instanceCount;
+	}
+	if (use_multi_draw_indirect_) {
+		if (culled) {
+			glBindBuffer(GL_ARRAY_BUFFER, instance_source);
+			RoomSegmentMesh::Instance::setAttribPointer(instance_offset / sizeof(RoomSegmentMesh::Instance));
+		}
+		// One submission per contiguous run of rendered meshes
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_source);
+		auto submit = [&](size_t begin, size_t end) {
+			if (begin >= end) return;
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+				(GLvoid*)(command_offset + begin * sizeof(DrawCommand)), (GLsizei)(end - begin), 0);
+			num_draw_calls_last_pass_++;
+		};
+		size_t run_begin = 0;
+		size_t run_end = 0;
+		for (const PackedMesh& p : packed_meshes_) {
+			if (skip_type && p.type == type_not_to_render) {
+				submit(run_begin, run_end);
+				run_begin = run_end = p.first_command + p.num_commands;
+				continue;
+			}
+			run_end = p.first_command + p.num_commands;
+		}
+		submit(run_begin, run_end);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		if (culled) {
+			// Back to the instance buffer for the next pass
+			glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_);
+			RoomSegmentMesh::Instance::setAttribPointer();
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+	}
+	else {
+		// Without base instance the attrib pointers are moved to the range of each mesh
+		glBindBuffer(GL_ARRAY_BUFFER, instance_source);
+		for (const PackedMesh& p : packed_meshes_) {
+			if ((skip_type && p.type == type_not_to_render) || p.num_commands == 0) continue;
+			const DrawCommand& range = (*commands)[p.first_command]; // same instances for all sub meshes
+			if (range.instanceCount == 0) continue;
+			RoomSegmentMesh::Instance::setAttribPointer(instance_offset / sizeof(RoomSegmentMesh::Instance) + range.baseInstance);
+			for (size_t c = p.first_command; c < p.first_command + p.num_commands; c++) {
+				glDrawElementsInstanced(GL_TRIANGLES, draw_commands_[c].count, GL_UNSIGNED_INT,
+					(GLvoid*)(draw_commands_[c].firstIndex * sizeof(GLuint)), range.instanceCount);
+				num_draw_calls_last_pass_++;
+			}
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	glBindVertexArray(0);
+}
+
+void RoomSegmentMeshPool::renderBakedRooms(glm::mat4& view_projection, bool culled, GLint isDepthPass, GLint isDebugMode) {
+	if (baked_rooms_.empty()) return;
+	glUseProgram(baked_shader_->getProgramId());
+	glUniformMatrix4fv(baked_uniform_locations_[0], 1, GL_FALSE, glm::value_ptr(view_projection));
+	glUniform1i(baked_uniform_locations_[1], isDepthPass);
+	glUniform1i(baked_uniform_locations_[2], isDebugMode);
+	material_textures_.bind(MATERIAL_TEXTURES_UNIT);
+	viscom::math::Frustum<float> frustum;
+	if (culled) frustum = viscom::math::extractFrustum<float>(view_projection);
+	for (BakedRoom* room : baked_rooms_)
+		if (!culled || viscom::math::AABBInFrustumTest(frustum, room->getBounds())) room->render();
+}
+
+void RoomSegmentMeshPool::renderAutomatonCells(glm::mat4& view_projection, bool culled, GLint isDepthPass, GLint isDebugMode) {
+	if (!gpu_driven_outer_influence_ || automaton_textures_[0] == 0 || frame_uniforms_.gridCellSize <= 0.0f) return;
+	GLint num_variations = 0;
+	for (const PackedMesh& p : packed_meshes_)
+		if (p.type == GridCell::BuildState::OUTER_INFLUENCE) num_variations++;
+	if (num_variations == 0) return;
+	glm::ivec2 grid_size = glm::ivec2(frame_uniforms_.gridDimensions / frame_uniforms_.gridCellSize + 0.5f);
+	// Only the cells of the visible tiles (bounding rect)
+	glm::ivec4 cell_rect = culled ? tile_tree_.getVisibleCellRect() : glm::ivec4(0, 0, grid_size.x, grid_size.y);
+	GLsizei num_cells = cell_rect.z * cell_rect.w;
+	if (num_cells <= 0) return;
+	glUseProgram(cell_shader_->getProgramId());
+	glUniformMatrix4fv(cell_uniform_locations_[0], 1, GL_FALSE, glm::value_ptr(view_projection));
+	glUniform1i(cell_uniform_locations_[1], isDepthPass);
+	glUniform1i(cell_uniform_locations_[2], isDebugMode);
+	glUniform1i(cell_uniform_locations_[4], num_variations);
+	glUniform4i(cell_uniform_locations_[5], cell_rect.x, cell_rect.y, cell_rect.z, cell_rect.w);
+	bindFrameState();
+	glBindVertexArray(cell_vao_);
+	glActiveTexture(GL_TEXTURE0 + SUB_MESH_DATA_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, sub_mesh_data_texture_);
+	material_textures_.bind(MATERIAL_TEXTURES_UNIT);
+	GLint variation = 0;
+	for (const PackedMesh& p : packed_meshes_) {
+		if (p.type != GridCell::BuildState::OUTER_INFLUENCE) continue;
+		glUniform1i(cell_uniform_locations_[3], variation++);
+		for (size_t c = p.first_command; c < p.first_command + p.num_commands; c++) {
+			glDrawElementsInstanced(GL_TRIANGLES, draw_commands_[c].count, GL_UNSIGNED_INT,
+				(GLvoid*)(draw_commands_[c].firstIndex * sizeof(GLuint)), num_cells);
+			num_draw_calls_last_pass_++;
+		}
+	}
+	glBindVertexArray(0);
+}
+
 void RoomSegmentMeshPool::renderAllMeshes(glm::mat4& view_projection, GLint isDepthPass, GLint isDebugMode) {
 	glUseProgram(shader_->getProgramId());
 	glUniformMatrix4fv(matrix_uniform_locations_[0], 1, GL_FALSE, glm::value_ptr(view_projection));
-	for (unsigned int i = 0; i < uniform_locations_.size(); i++) uniform_callbacks_[i](uniform_locations_[i]);
+	bindFrameState();
 	glUniform1i(depth_pass_flag_uniform_location_, isDepthPass);
 	if (isDebugMode == 1) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 	else glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	glUniform1i(debug_mode_flag_uniform_location_, isDebugMode);
-	for (GridCell::BuildState i : render_list_) {
-		for (RoomSegmentMesh* mesh : meshes_[i]) {
-			mesh->renderAllInstances(&matrix_uniform_locations_);
-		}
-	}
+	bool culled = cullTiles(view_projection);
+	renderPacked(culled, false, GridCell::BuildState::EMPTY);
+	renderAutomatonCells(view_projection, culled, isDepthPass, isDebugMode);
+	renderBakedRooms(view_projection, culled, isDepthPass, isDebugMode);
+	unbindFrameState();
 }
 
 void RoomSegmentMeshPool::renderAllMeshesExcept(glm::mat4& view_projection, GridCell::BuildState type_not_to_render, GLint isDepthPass, GLint isDebugMode) {
 	glUseProgram(shader_->getProgramId());
 	glUniformMatrix4fv(matrix_uniform_locations_[0], 1, GL_FALSE, glm::value_ptr(view_projection));
-	for (unsigned int i = 0; i < uniform_locations_.size(); i++) uniform_callbacks_[i](uniform_locations_[i]);
+	bindFrameState();
 	glUniform1i(depth_pass_flag_uniform_location_, isDepthPass);
 	if (isDebugMode == 1) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 	else glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	glUniform1i(debug_mode_flag_uniform_location_, isDebugMode);
-	for (GridCell::BuildState i : render_list_) {
-		if (i == type_not_to_render) continue;
-		for (RoomSegmentMesh* mesh : meshes_[i]) {
-			mesh->renderAllInstances(&matrix_uniform_locations_);
-		}
-	}
+	bool culled = cullTiles(view_projection);
+	renderPacked(culled, true, type_not_to_render);
+	if (type_not_to_render != GridCell::BuildState::OUTER_INFLUENCE)
+		renderAutomatonCells(view_projection, culled, isDepthPass, isDebugMode);
+	renderBakedRooms(view_projection, culled, isDepthPass, isDebugMode);
+	unbindFrameState();
 }
 
 void RoomSegmentMeshPool::loadShader(viscom::GPUProgramManager mgr) {
 	shader_ = mgr.GetResource("renderMeshInstance",
 			std::initializer_list<std::string>{ "renderMeshInstance.vert", "renderMeshInstance.frag" });
-	matrix_uniform_locations_ = shader_->getUniformLocations({
-		"viewProjectionMatrix", "subMeshLocalMatrix", "normalMatrix" });
+	matrix_uniform_locations_ = shader_->getUniformLocations({ "viewProjectionMatrix" });
 	depth_pass_flag_uniform_location_ = shader_->getUniformLocation("isDepthPass");
 	debug_mode_flag_uniform_location_ = shader_->getUniformLocation("isDebugMode");
+	setupProgram(shader_->getProgramId());
+	baked_shader_ = mgr.GetResource("renderBakedRoom",
+			std::initializer_list<std::string>{ "renderBakedRoom.vert", "renderMeshInstance.frag" });
+	baked_uniform_locations_ = baked_shader_->getUniformLocations({
+		"viewProjectionMatrix", "isDepthPass", "isDebugMode" });
+	setupProgram(baked_shader_->getProgramId());
+	cell_shader_ = mgr.GetResource("renderAutomatonCells",
+			std::initializer_list<std::string>{ "renderAutomatonCells.vert", "renderMeshInstance.frag" });
+	cell_uniform_locations_ = cell_shader_->getUniformLocations({
+		"viewProjectionMatrix", "isDepthPass", "isDebugMode", "variation", "numVariations", "cellRect" });
+	setupProgram(cell_shader_->getProgramId());
+}
+
+void RoomSegmentMeshPool::setupProgram(GLuint program) {
+	// Block binding and sampler units never change, set them once per program
+	GLuint block = glGetUniformBlockIndex(program, "PoolFrame");
+	if (block != GL_INVALID_INDEX) glUniformBlockBinding(program, block, FRAME_UNIFORM_BINDING);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "gridTex"), AUTOMATON_TEXTURE_UNIT);
+	glUniform1i(glGetUniformLocation(program, "gridTex_PrevState"), AUTOMATON_TEXTURE_UNIT + 1);
+	glUniform1i(glGetUniformLocation(program, "subMeshData"), SUB_MESH_DATA_UNIT);
+	GLint material_units[MaterialTextureArrays::MAX_ARRAYS];
+	for (size_t i = 0; i < MaterialTextureArrays::MAX_ARRAYS; i++) material_units[i] = MATERIAL_TEXTURES_UNIT + (GLint)i;
+	glUniform1iv(glGetUniformLocation(program, "materialTextures"), MaterialTextureArrays::MAX_ARRAYS, material_units);
+	glUseProgram(0);
+}
+
+void RoomSegmentMeshPool::setGridGeometry(glm::vec2 dimensions, glm::vec3 translation, float cell_size) {
+	if (frame_uniforms_.gridDimensions == dimensions && frame_uniforms_.gridTranslation == translation
+		&& frame_uniforms_.gridCellSize == cell_size) return;
+	frame_uniforms_.gridDimensions = dimensions;
+	frame_uniforms_.gridTranslation = translation;
+	frame_uniforms_.gridCellSize = cell_size;
+	frame_uniforms_dirty_ = true;
+	grid_geometry_.translation = translation;
+	grid_geometry_.cell_size = cell_size;
+	grid_geometry_.columns = (GLuint)(dimensions.x / cell_size + 0.5f);
+	tile_tree_dirty_ = true;
+}
+
+void RoomSegmentMeshPool::setAutomatonState(GLuint latest_texture, GLuint previous_texture, float time_delta) {
+	automaton_textures_[0] = latest_texture;
+	automaton_textures_[1] = previous_texture;
+	if (frame_uniforms_.automatonTimeDelta == time_delta) return;
+	frame_uniforms_.automatonTimeDelta = time_delta;
+	frame_uniforms_dirty_ = true;
+}
+
+void RoomSegmentMeshPool::setTime(float t_sec) {
+	if (frame_uniforms_.t_sec == t_sec) return;
+	frame_uniforms_.t_sec = t_sec;
+	frame_uniforms_dirty_ = true;
+}
+
+void RoomSegmentMeshPool::setGpuDrivenOuterInfluence(bool on) {
+	gpu_driven_outer_influence_ = on;
+}
+
+void RoomSegmentMeshPool::setUploadBuffer(StreamingBuffer* upload_buffer) {
+	upload_buffer_ = upload_buffer;
+}
+
+void RoomSegmentMeshPool::setFrustumCulling(bool on) {
+	frustum_culling_ = on;
+}
+
+void RoomSegmentMeshPool::bindFrameState() {
+	if (frame_uniform_buffer_ == 0) {
+		glGenBuffers(1, &frame_uniform_buffer_);
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_uniform_buffer_);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), (GLvoid*)0, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		// Black border, so cells outside the grid are empty
+		glGenSamplers(1, &automaton_sampler_);
+		glSamplerParameteri(automaton_sampler_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glSamplerParameteri(automaton_sampler_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(automaton_sampler_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glSamplerParameteri(automaton_sampler_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		float borderColor[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		glSamplerParameterfv(automaton_sampler_, GL_TEXTURE_BORDER_COLOR, borderColor);
+	}
+	// At most one upload per frame, passes of the same frame reuse it
+	if (frame_uniforms_dirty_) {
+		upload_buffer_->upload(frame_uniform_buffer_, 0, &frame_uniforms_, sizeof(FrameUniforms));
+		frame_uniforms_dirty_ = false;
+		num_frame_uniform_uploads_++;
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, frame_uniform_buffer_);
+	for (GLuint i = 0; i < 2; i++) {
+		glActiveTexture(GL_TEXTURE0 + AUTOMATON_TEXTURE_UNIT + i);
+		glBindTexture(GL_TEXTURE_2D, automaton_textures_[i]);
+		glBindSampler(AUTOMATON_TEXTURE_UNIT + i, automaton_sampler_);
+	}
+}
+
+void RoomSegmentMeshPool::unbindFrameState() {
+	// Other users of the units rely on their texture parameters (automaton wraps, background repeats)
+	for (GLuint i = 0; i < 2; i++) glBindSampler(AUTOMATON_TEXTURE_UNIT + i, 0);
+	material_textures_.unbind(MATERIAL_TEXTURES_UNIT);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+std::vector<RoomSegmentMeshPool::InstanceStatistics> RoomSegmentMeshPool::getInstanceStatistics() {
+	std::vector<InstanceStatistics> stats;
+	std::set<RoomSegmentMesh*> visited; // render list can name a mesh more than once
+	for (GridCell::BuildState type : render_list_) {
+		for (RoomSegmentMesh* mesh : meshes_[type]) {
+			if (!visited.insert(mesh).second) continue;
+			const RoomSegmentMesh::InstanceBuffer& buffer = mesh->getUnorderedBuffer();
+			InstanceStatistics s;
+			s.type = type;
+			s.num_instances = buffer.num_instances_;
+			s.high_water_instances = buffer.high_water_instances_;
+			s.num_room_ordered_instances = mesh->getNumRoomOrderedInstances();
+			s.pool_allocation_instances = buffer.pool_allocation_bytes_ / sizeof(RoomSegmentMesh::Instance);
+			s.capacity_instances = buffer.capacity_bytes_ / sizeof(RoomSegmentMesh::Instance);
+			s.num_reallocations = buffer.num_reallocations_;
+			stats.push_back(s);
+		}
+	}
+	return stats;
+}
+
+size_t RoomSegmentMeshPool::getNumDrawCallsLastPass() {
+	return num_draw_calls_last_pass_;
+}
+
+bool RoomSegmentMeshPool::isMultiDrawIndirect() {
+	return use_multi_draw_indirect_;
+}
+
+size_t RoomSegmentMeshPool::getNumBakedRooms() {
+	return baked_rooms_.size();
+}
+
+size_t RoomSegmentMeshPool::getNumRebakes() {
+	return num_rebakes_;
+}
+
+size_t RoomSegmentMeshPool::getNumFrameUniformUploads() {
+	return num_frame_uniform_uploads_;
+}
+
+bool RoomSegmentMeshPool::isGpuDrivenOuterInfluence() {
+	return gpu_driven_outer_influence_;
+}
+
+bool RoomSegmentMeshPool::isFrustumCulling() {
+	return frustum_culling_;
+}
+
+size_t RoomSegmentMeshPool::getNumTiles() {
+	return tile_tree_.getNumTiles();
+}
+
+size_t RoomSegmentMeshPool::getNumVisibleTilesLastPass() {
+	return tile_tree_.getNumVisibleTiles();
 }
 
-void RoomSegmentMeshPool::updateUniformEveryFrame(std::string uniform_name, std::function<void(GLint)> update_func) {
-	uniform_locations_.push_back(shader_->getUniformLocation(uniform_name));
-	uniform_callbacks_.push_back(update_func);
+size_t RoomSegmentMeshPool::getNumInstancesLastPass() {
+	return num_instances_last_pass_;
 }
 
-GLint RoomSegmentMeshPool::getUniformLocation(size_t index) {
-	return uniform_locations_[index];
+size_t RoomSegmentMeshPool::getNumDrawnInstancesLastPass() {
+	return num_drawn_instances_last_pass_;
 }
 
 GLuint RoomSegmentMeshPool::getShaderID() {
@@ -8,8 +8,48 @@
 #include "../Vertices.h"
 #include "InteractiveGrid.h"
 #include "RoomSegmentMesh.h"
+#include "BakedRoom.h"
+#include "MaterialTextureArrays.h"
+#include "GridTileTree.h"
+#include "core/math/transforms.h"
 
 class RoomSegmentMeshPool {
+public:
+	// Actual use of the instance buffers, to tune the pool allocation heuristics
+	struct InstanceStatistics {
+		GridCell::BuildState type; // representative build state
+		int num_instances;
+		int high_water_instances;
+		int num_room_ordered_instances;
+		size_t pool_allocation_instances;
+		size_t capacity_instances;
+		size_t num_reallocations;
+	};
+	// Layout of glMultiDrawElementsIndirect commands
+	struct DrawCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+	// Per-frame state of the pool shaders (std140 uniform block PoolFrame)
+	struct FrameUniforms {
+		glm::vec3 gridTranslation;
+		GLfloat gridCellSize;
+		glm::vec2 gridDimensions;
+		GLfloat automatonTimeDelta;
+		GLfloat t_sec;
+	};
+	// Vertex of the packed geometry of all meshes (VTX: viscom::SimpleMeshVertex or viscom::PackedMeshVertex)
+	template<class VTX> struct PoolVertex {
+		VTX vertex_;
+		GLint subMeshIndex_;
+	};
+	// Vertex format of the pool geometry, the position scale of packed formats goes into the sub mesh matrix
+	typedef viscom::PackedMeshVertex PoolVertexFormat;
+	typedef PoolVertex<PoolVertexFormat> PackedVertex;
+private:
 	// Map build state to multiple mesh variations
 	// (when there is one mesh for multiple build states,
 	// store the same pointer multiple times)
@@ -23,10 +63,82 @@ class RoomSegmentMeshPool {
 	std::shared_ptr<viscom::GPUProgram> shader_;
 	// Uniforms
 	std::vector<GLint> matrix_uniform_locations_;
-	std::vector<GLint> uniform_locations_;
-	std::vector<std::function<void(GLint)>> uniform_callbacks_;
 	GLint depth_pass_flag_uniform_location_;
 	GLint debug_mode_flag_uniform_location_;
+	// Finished rooms drawn as static geometry (instead of their room-ordered instances)
+	std::vector<BakedRoom*> baked_rooms_;
+	std::shared_ptr<viscom::GPUProgram> baked_shader_;
+	std::vector<GLint> baked_uniform_locations_; // view projection, depth pass, debug mode
+	size_t num_rebakes_;
+	// Change counters of the instance data, per representative build state and for baked rooms
+	std::unordered_map<GridCell::BuildState, size_t> instance_versions_;
+	size_t baked_version_;
+	// All meshes packed into shared vertex, index and instance buffers
+	// Each sub mesh is one draw command, commands of a mesh are contiguous
+	// Sub mesh local matrices and material layers are read from a buffer texture instead of uniforms
+	struct PackedMesh {
+		RoomSegmentMesh* mesh;
+		GridCell::BuildState type; // representative build state
+		size_t first_command;
+		size_t num_commands;
+		viscom::math::AABB3<float> bounds; // instance space, for all rotations of the build states
+	};
+	std::vector<PackedMesh> packed_meshes_;
+	std::vector<DrawCommand> draw_commands_;
+	bool is_packed_;
+	bool use_multi_draw_indirect_; // else one draw per command
+	GLuint packed_vao_;
+	GLuint packed_vbo_;
+	GLuint packed_ibo_;
+	GLuint instance_buffer_;
+	GLuint command_buffer_;
+	static const GLint SUB_MESH_DATA_TEXELS = 5;
+	static const GLint SUB_MESH_DATA_UNIT = 2; // units 0 and 1 hold the automaton textures
+	static const GLint MATERIAL_TEXTURES_UNIT = 3;
+	GLuint sub_mesh_data_buffer_;
+	GLuint sub_mesh_data_texture_;
+	MaterialTextureArrays material_textures_;
+	size_t num_draw_calls_last_pass_;
+	void packMeshes();
+	void layoutInstanceBuffer();
+	void preparePackedDraw();
+	void updateDrawCommands();
+	void renderPacked(bool culled, bool skip_type, GridCell::BuildState type_not_to_render);
+	// View frustum culling against a tile tree over the grid, each pass culls with its own matrix
+	// (slaves only draw the cells in view of their projector)
+	GridTileTree tile_tree_;
+	bool tile_tree_dirty_; // grid geometry or mesh bounds changed
+	bool frustum_culling_;
+	std::vector<RoomSegmentMesh::Instance> culled_instances_;
+	std::vector<DrawCommand> culled_commands_;
+	size_t num_instances_last_pass_;
+	size_t num_drawn_instances_last_pass_;
+	// Returns true if some tiles are culled
+	bool cullTiles(glm::mat4& view_projection);
+	// Copies the slot ranges of the visible tiles into the upload buffer, returns false if they do not fit
+	bool cullInstances(bool skip_type, GridCell::BuildState type_not_to_render, GLintptr& instance_offset, GLintptr& command_offset);
+	// Per-frame state, uploaded once per frame when changed
+	static const GLuint FRAME_UNIFORM_BINDING = 0;
+	static const GLint AUTOMATON_TEXTURE_UNIT = 0; // latest, previous at the next unit
+	FrameUniforms frame_uniforms_;
+	RoomSegmentMesh::GridGeometry grid_geometry_; // same placement on the CPU (bounds, baking)
+	bool frame_uniforms_dirty_;
+	GLuint frame_uniform_buffer_;
+	GLuint automaton_textures_[2]; // latest, previous
+	GLuint automaton_sampler_;
+	size_t num_frame_uniform_uploads_;
+	StreamingBuffer* upload_buffer_; // all per-frame uploads of the pool and its meshes
+	void setupProgram(GLuint program);
+	void bindFrameState();
+	void unbindFrameState(); // sampler objects override the parameters of other users of the units
+	void renderBakedRooms(glm::mat4& view_projection, bool culled, GLint isDepthPass, GLint isDebugMode);
+	// Outer influence drawn instanced over all cells, culled by the automaton state in the vertex shader
+	// (no mesh instances, so no CPU work when the automaton changes cells)
+	bool gpu_driven_outer_influence_;
+	std::shared_ptr<viscom::GPUProgram> cell_shader_;
+	std::vector<GLint> cell_uniform_locations_; // view projection, depth pass, debug mode, variation, number of variations, cell rect
+	GLuint cell_vao_; // packed geometry without instance attribs
+	void renderAutomatonCells(glm::mat4& view_projection, bool culled, GLint isDepthPass, GLint isDebugMode);
 public:
 	RoomSegmentMeshPool(const size_t MAX_INSTANCES);
 	~RoomSegmentMeshPool();
@@ -36,14 +148,39 @@ public:
 	void addMeshVariations(std::vector<GridCell::BuildState> types, std::vector<std::shared_ptr<viscom::Mesh>> mesh_variations);
 	// Building function (request mesh for given build state)
 	RoomSegmentMesh* getMeshOfType(GridCell::BuildState type);
+	// Bake the room-ordered ranges of a finished room, the pool owns the result
+	BakedRoom* bakeRoom(const std::vector<RoomSegmentMesh::InstanceBufferRange>& ranges);
+	// Upload instance edits of all meshes and re-bake rooms, returns number of uploads
+	size_t commitInstances();
+	// Changes whenever instance data of the drawn meshes changes (to cache renderings, e.g. shadows)
+	size_t getInstanceVersionExcept(GridCell::BuildState type_not_counted);
+	// World space bounds of all visible instances, returns false if there are none
+	bool getInstanceBoundsExcept(GridCell::BuildState type_not_counted, viscom::math::AABB3<float>& bounds);
 	// Render function (renders each mesh once by using render list)
 	void renderAllMeshes(glm::mat4& view_projection, GLint isDepthPass = 0, GLint isDebugMode = 0);
 	void renderAllMeshesExcept(glm::mat4& view_projection, GridCell::BuildState type_not_to_render, GLint isDepthPass = 0, GLint isDebugMode = 0);
 	void cleanup();
-	// Set a uniform with a update function for the mesh pool shader
-	void updateUniformEveryFrame(std::string uniform_name, std::function<void(GLint)> update_func);
+	// Per-frame state, unchanged values are not re-sent
+	void setGridGeometry(glm::vec2 dimensions, glm::vec3 translation, float cell_size);
+	void setAutomatonState(GLuint latest_texture, GLuint previous_texture, float time_delta);
+	void setTime(float t_sec);
+	void setGpuDrivenOuterInfluence(bool on);
+	// Set before the first commit
+	void setUploadBuffer(StreamingBuffer* upload_buffer);
+	void setFrustumCulling(bool on);
 	// Getter
-	GLint getUniformLocation(size_t index);
+	std::vector<InstanceStatistics> getInstanceStatistics();
+	size_t getNumDrawCallsLastPass();
+	bool isMultiDrawIndirect();
+	size_t getNumBakedRooms();
+	size_t getNumRebakes();
+	size_t getNumFrameUniformUploads();
+	bool isGpuDrivenOuterInfluence();
+	bool isFrustumCulling();
+	size_t getNumTiles();
+	size_t getNumVisibleTilesLastPass();
+	size_t getNumInstancesLastPass();
+	size_t getNumDrawnInstancesLastPass();
 	GLuint getShaderID();
 private:
 	// Pool allocation bytes based on estimated number of instances
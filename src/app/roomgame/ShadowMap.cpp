@@ -1,16 +1,93 @@
 #include "ShadowMap.h"
 
-ShadowMap::ShadowMap(unsigned int w, unsigned int h) :
-	FrameBuffer(w, h, { { viscom::FrameBufferTextureDescriptor(GL_DEPTH_COMPONENT32F) },{} }),
-	light_matrix_(1)
+ShadowMap::ShadowMap(Quality q) :
+	FrameBuffer(getResolution(q), getResolution(q), { { viscom::FrameBufferTextureDescriptor(GL_DEPTH_COMPONENT32F) },{} }),
+	quality_(q),
+	light_matrix_(1),
+	light_projection_(1),
+	rendered_light_space_(1),
+	rendered_caster_version_(0),
+	is_rendered_(false),
+	num_renders_(0),
+	num_skips_(0)
 {
 
 }
 
+unsigned int ShadowMap::getResolution(Quality q) {
+	switch (q) {
+	case LOW: return 512;
+	case HIGH: return 2048;
+	default: return 1024;
+	}
+}
+
 glm::mat4& ShadowMap::getLightMatrix() {
 	return light_matrix_;
 }
 
 void ShadowMap::setLightMatrix(glm::mat4& light_matrix) {
+	if (light_matrix != light_matrix_) is_rendered_ = false;
 	light_matrix_ = light_matrix;
+}
+
+void ShadowMap::setLightProjection(const glm::mat4& light_projection) {
+	if (light_projection != light_projection_) is_rendered_ = false;
+	light_projection_ = light_projection;
+}
+
+void ShadowMap::fitLightProjection(const viscom::math::AABB3<float>& casters, const viscom::math::AABB3<float>& receivers) {
+	// Bounds in light view space (the light looks along -z)
+	viscom::math::AABB3<float> c = viscom::math::transformAABB(casters, light_matrix_);
+	viscom::math::AABB3<float> r = viscom::math::transformAABB(receivers, light_matrix_);
+	// One texel of margin, so casters at the border still cover whole texels
+	glm::vec2 margin = glm::vec2(c.minmax[1] - c.minmax[0]) / (float)getResolution(quality_);
+	float near_plane = -c.minmax[1].z - 0.01f;
+	float far_plane = -glm::min(c.minmax[0].z, r.minmax[0].z) + 0.01f;
+	setLightProjection(glm::ortho(c.minmax[0].x - margin.x, c.minmax[1].x + margin.x,
+		c.minmax[0].y - margin.y, c.minmax[1].y + margin.y, near_plane, far_plane));
+}
+
+void ShadowMap::setQuality(Quality q) {
+	if (q == quality_) return;
+	quality_ = q;
+	Resize(getResolution(q), getResolution(q));
+	is_rendered_ = false;
+}
+
+ShadowMap::Quality ShadowMap::getQuality() {
+	return quality_;
+}
+
+glm::mat4 ShadowMap::getLightSpaceMatrix() const {
+	return light_projection_ * light_matrix_;
+}
+
+bool ShadowMap::update(const glm::mat4& light_space, size_t caster_version, std::function<void()> render_casters) {
+	if (is_rendered_ && caster_version == rendered_caster_version_ && light_space == rendered_light_space_) {
+		num_skips_++;
+		return false;
+	}
+	DrawToFBO([&]() {
+		glClearDepth(1.0f);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		render_casters();
+	});
+	rendered_light_space_ = light_space;
+	rendered_caster_version_ = caster_version;
+	is_rendered_ = true;
+	num_renders_++;
+	return true;
+}
+
+void ShadowMap::invalidate() {
+	is_rendered_ = false;
+}
+
+size_t ShadowMap::getNumRenders() {
+	return num_renders_;
+}
+
+size_t ShadowMap::getNumSkips() {
+	return num_skips_;
 }
\ No newline at end of file
@@ -1,17 +1,52 @@
 #ifndef SHADOW_MAP_H
 #define SHADOW_MAP_H
 
+#include <functional>
 #include "core/gfx/FrameBuffer.h"
+#include "core/math/transforms.h"
 
+/*
+* Depth map rendered from the light.
+* The rendering is cached: it is only redone when the light space matrix
+* or the version of the shadow casting instances changed.
+* Light space does not depend on the window, so all windows and projectors
+* of a node share one rendering.
+*/
 class ShadowMap : public viscom::FrameBuffer {
-	glm::mat4 light_matrix_;
 public:
-	ShadowMap(unsigned int w, unsigned int h);
+	// Resolution tiers
+	enum Quality {
+		LOW, MEDIUM, HIGH
+	};
+	static unsigned int getResolution(Quality q);
+private:
+	Quality quality_;
+	glm::mat4 light_matrix_; // view
+	glm::mat4 light_projection_;
+	glm::mat4 rendered_light_space_;
+	size_t rendered_caster_version_;
+	bool is_rendered_;
+	size_t num_renders_;
+	size_t num_skips_;
+public:
+	ShadowMap(Quality q);
 	GLuint get() const {
 		return textures_[0];
 	}
 	glm::mat4& getLightMatrix();
 	void setLightMatrix(glm::mat4&);
+	void setLightProjection(const glm::mat4&);
+	// Orthographic projection tightly around the casters, with depth reaching the receivers
+	void fitLightProjection(const viscom::math::AABB3<float>& casters, const viscom::math::AABB3<float>& receivers);
+	void setQuality(Quality q);
+	Quality getQuality();
+	// Projection * view of the light
+	glm::mat4 getLightSpaceMatrix() const;
+	// Clears and renders with render_casters if the cached map is out of date
+	bool update(const glm::mat4& light_space, size_t caster_version, std::function<void()> render_casters);
+	void invalidate();
+	size_t getNumRenders();
+	size_t getNumSkips();
 };
 
 #endif
\ No newline at end of file
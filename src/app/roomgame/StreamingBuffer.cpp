@@ -0,0 +1,121 @@
+#include "StreamingBuffer.h"
+#include <cstring>
+
+StreamingBuffer::StreamingBuffer(size_t section_bytes) :
+	section_bytes_(section_bytes),
+	is_persistent_(GLEW_ARB_buffer_storage != 0),
+	mapped_(0),
+	section_(0),
+	cursor_(0),
+	section_busy_(false),
+	bytes_this_frame_(0),
+	bytes_last_frame_(0),
+	uploads_this_frame_(0),
+	uploads_last_frame_(0),
+	num_stalls_(0),
+	num_overflows_(0)
+{
+	for (size_t i = 0; i < NUM_SECTIONS; i++) fences_[i] = 0;
+	glGenBuffers(1, &id_);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, id_);
+	GLsizeiptr total_bytes = (GLsizeiptr)(NUM_SECTIONS * section_bytes_);
+	if (is_persistent_) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, total_bytes, (GLvoid*)0, flags);
+		mapped_ = (GLubyte*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total_bytes, flags);
+		is_persistent_ = (mapped_ != 0);
+	}
+	if (!is_persistent_)
+		glBufferData(GL_COPY_WRITE_BUFFER, total_bytes, (GLvoid*)0, GL_STREAM_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+StreamingBuffer::~StreamingBuffer() {
+	for (size_t i = 0; i < NUM_SECTIONS; i++)
+		if (fences_[i]) glDeleteSync(fences_[i]);
+	if (mapped_) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, id_);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &id_);
+}
+
+void StreamingBuffer::beginFrame() {
+	section_ = (section_ + 1) % NUM_SECTIONS;
+	cursor_ = 0;
+	section_busy_ = false;
+	GLsync& fence = fences_[section_];
+	if (fence) {
+		// Only wait if the GPU is NUM_SECTIONS - 1 frames behind
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			num_stalls_++;
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); // nanoseconds
+		}
+		if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+			// GPU may still read the section, keep the fence and write nothing into it
+			section_busy_ = true;
+			return;
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+}
+
+void StreamingBuffer::endFrame() {
+	GLsync& fence = fences_[section_];
+	if (fence) glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	bytes_last_frame_ = bytes_this_frame_;
+	uploads_last_frame_ = uploads_this_frame_;
+	bytes_this_frame_ = 0;
+	uploads_this_frame_ = 0;
+}
+
+GLintptr StreamingBuffer::allocate(size_t bytes) {
+	if (section_busy_) return -1; // callers fall back to their own upload path
+	size_t begin = (cursor_ + 15) & ~(size_t)15; // keep offsets aligned for any data type
+	if (begin + bytes > section_bytes_) {
+		num_overflows_++;
+		return -1;
+	}
+	cursor_ = begin + bytes;
+	bytes_this_frame_ += bytes;
+	uploads_this_frame_++;
+	return (GLintptr)(section_ * section_bytes_ + begin);
+}
+
+GLintptr StreamingBuffer::stream(const void* data, size_t bytes) {
+	GLintptr offset = allocate(bytes);
+	if (offset < 0) return -1;
+	if (is_persistent_) {
+		std::memcpy(mapped_ + offset, data, bytes);
+	}
+	else {
+		// Section is not in flight (fenced), so the driver need not wait either
+		glBindBuffer(GL_COPY_WRITE_BUFFER, id_);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, (GLsizeiptr)bytes, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	return offset;
+}
+
+void StreamingBuffer::upload(GLuint destination, GLintptr offset, const void* data, size_t bytes) {
+	if (bytes == 0) return;
+	GLintptr source = is_persistent_ ? stream(data, bytes) : -1;
+	if (source >= 0) {
+		// Ordered on the GPU after earlier draws, instead of a CPU sync in the driver
+		glBindBuffer(GL_COPY_READ_BUFFER, id_);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source, offset, (GLsizeiptr)bytes);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return;
+	}
+	bytes_this_frame_ += bytes;
+	uploads_this_frame_++;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset, (GLsizeiptr)bytes, data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef STREAMING_BUFFER_H
+#define STREAMING_BUFFER_H
+
+#include <vector>
+#include <sgct/Engine.h>
+
+/*
+* Shared allocator for per-frame uploads.
+* One buffer split into NUM_SECTIONS sections, the frame writes into one
+* section while the GPU may still read the others. A fence per section
+* guards reuse, so the CPU never writes memory that is in flight.
+* With ARB_buffer_storage the buffer is persistently mapped and uploads
+* are a memcpy plus a copy on the GPU (no driver synchronization).
+* Without, data goes to the destination via glBufferSubData.
+*/
+class StreamingBuffer {
+public:
+	static const size_t NUM_SECTIONS = 3;
+private:
+	GLuint id_;
+	size_t section_bytes_;
+	bool is_persistent_;
+	GLubyte* mapped_;
+	GLsync fences_[NUM_SECTIONS];
+	size_t section_;
+	size_t cursor_; // bytes used in the current section
+	bool section_busy_; // wait timed out, the frame falls back to glBufferSubData
+	size_t bytes_this_frame_;
+	size_t bytes_last_frame_;
+	size_t uploads_this_frame_;
+	size_t uploads_last_frame_;
+	size_t num_stalls_; // frames that had to wait for a section
+	size_t num_overflows_; // uploads that did not fit into the section
+	GLintptr allocate(size_t bytes);
+public:
+	StreamingBuffer(size_t section_bytes);
+	~StreamingBuffer();
+	// Switch to the next section, waits if the GPU still reads from it
+	// (if it does not finish in time, this frame does not use the section)
+	void beginFrame();
+	// Fence the section of this frame
+	void endFrame();
+	// Write into the ring, returns the offset in getBufferId() or -1 if the section is full
+	GLintptr stream(const void* data, size_t bytes);
+	// Copy into [offset, offset+bytes) of another buffer
+	void upload(GLuint destination, GLintptr offset, const void* data, size_t bytes);
+	GLuint getBufferId() { return id_; }
+	bool isPersistent() { return is_persistent_; }
+	size_t getSectionBytes() { return section_bytes_; }
+	size_t getBytesLastFrame() { return bytes_last_frame_; }
+	size_t getUploadsLastFrame() { return uploads_last_frame_; }
+	size_t getNumStalls() { return num_stalls_; }
+	size_t getNumOverflows() { return num_overflows_; }
+};
+
+#endif
\ No newline at end of file
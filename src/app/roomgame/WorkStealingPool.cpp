@@ -0,0 +1,99 @@
+#include "WorkStealingPool.h"
+
+WorkStealingPool::WorkStealingPool(size_t num_threads) {
+	if (num_threads == 0) num_threads = 1;
+	job_ = 0;
+	job_id_ = 0;
+	num_remaining_tasks_ = 0;
+	num_steals_ = 0;
+	quit_ = false;
+	for (size_t i = 0; i < num_threads; i++)
+		workers_.emplace_back(new Worker());
+	for (size_t i = 1; i < num_threads; i++)
+		threads_.emplace_back(&WorkStealingPool::workerLoop, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard<std::mutex> lock(job_mutex_);
+		quit_ = true;
+	}
+	job_started_.notify_all();
+	for (std::thread& t : threads_) t.join();
+}
+
+void WorkStealingPool::parallelFor(size_t num_tasks, const std::function<void(size_t)>& task) {
+	if (num_tasks == 0) return;
+	// Set job before tasks become visible to workers
+	job_ = &task;
+	num_remaining_tasks_ = num_tasks;
+	// Contiguous blocks, so neighboring tasks start on the same worker
+	size_t n = workers_.size();
+	for (size_t w = 0; w < n; w++) {
+		std::lock_guard<std::mutex> lock(workers_[w]->mutex);
+		for (size_t i = w * num_tasks / n; i < (w + 1) * num_tasks / n; i++)
+			workers_[w]->tasks.push_back(i);
+	}
+	{
+		std::lock_guard<std::mutex> lock(job_mutex_);
+		job_id_++;
+	}
+	job_started_.notify_all();
+	runTasks(0);
+	std::unique_lock<std::mutex> lock(job_mutex_);
+	job_done_.wait(lock, [this] { return num_remaining_tasks_ == 0; });
+}
+
+void WorkStealingPool::workerLoop(size_t worker) {
+	size_t last_job_id = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(job_mutex_);
+			job_started_.wait(lock, [&] { return quit_ || job_id_ != last_job_id; });
+			if (quit_) return;
+			last_job_id = job_id_;
+		}
+		runTasks(worker);
+	}
+}
+
+void WorkStealingPool::runTasks(size_t worker) {
+	size_t task;
+	while (popTask(worker, task) || stealTask(worker, task)) {
+		(*job_)(task);
+		if (--num_remaining_tasks_ == 0) {
+			std::lock_guard<std::mutex> lock(job_mutex_);
+			job_done_.notify_all();
+		}
+	}
+}
+
+bool WorkStealingPool::popTask(size_t worker, size_t& task) {
+	std::lock_guard<std::mutex> lock(workers_[worker]->mutex);
+	if (workers_[worker]->tasks.empty()) return false;
+	task = workers_[worker]->tasks.back();
+	workers_[worker]->tasks.pop_back();
+	return true;
+}
+
+bool WorkStealingPool::stealTask(size_t thief, size_t& task) {
+	size_t n = workers_.size();
+	for (size_t i = 1; i < n; i++) {
+		Worker* victim = workers_[(thief + i) % n].get();
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if (victim->tasks.empty()) continue;
+		task = victim->tasks.front();
+		victim->tasks.pop_front();
+		num_steals_++;
+		return true;
+	}
+	return false;
+}
+
+size_t WorkStealingPool::getNumThreads() {
+	return workers_.size();
+}
+
+size_t WorkStealingPool::getNumSteals() {
+	return num_steals_;
+}
\ No newline at end of file
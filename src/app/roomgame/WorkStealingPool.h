@@ -0,0 +1,48 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+* Thread pool for data-parallel loops.
+* Each worker owns a queue of task indices. It takes tasks from the back
+* of its own queue and, when empty, steals from the front of other queues.
+* The calling thread works as worker 0.
+*/
+class WorkStealingPool {
+	struct Worker {
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::thread> threads_;
+	std::mutex job_mutex_;
+	std::condition_variable job_started_;
+	std::condition_variable job_done_;
+	const std::function<void(size_t)>* job_;
+	size_t job_id_;
+	std::atomic<size_t> num_remaining_tasks_;
+	std::atomic<size_t> num_steals_;
+	bool quit_;
+	void workerLoop(size_t worker);
+	void runTasks(size_t worker);
+	bool popTask(size_t worker, size_t& task);
+	bool stealTask(size_t thief, size_t& task);
+public:
+	// Total number of threads including the calling thread
+	WorkStealingPool(size_t num_threads);
+	~WorkStealingPool();
+	// Runs task(i) for all i in [0, num_tasks), returns when all are done
+	void parallelFor(size_t num_tasks, const std::function<void(size_t)>& task);
+	size_t getNumThreads();
+	size_t getNumSteals();
+};
+
+#endif
\ No newline at end of file
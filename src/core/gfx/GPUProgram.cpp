@@ -26,7 +26,27 @@ namespace viscom {
         for (const auto& shaderName : shaderNames_) {
             shaders_.emplace_back(std::make_unique<Shader>(shaderName, node));
         }
-        program_ = linkNewProgram(programName_, shaders_, [](const std::unique_ptr<Shader>& shdr) noexcept { return shdr->getShaderId(); });
+        program_ = linkNewProgram(programName_, shaders_, [](const std::unique_ptr<Shader>& shdr) noexcept { return shdr->getShaderId(); }, feedbackVaryings_);
+    }
+
+    /**
+     * Constructor for programs whose outputs are captured by transform feedback.
+     * @param theProgramName the name of the program used to identify during logging.
+     * @param theShaderNames the filenames of all shaders to use in this program.
+     * @param theFeedbackVaryings the outputs to capture (interleaved in one buffer).
+     */
+    GPUProgram::GPUProgram(const std::string& theProgramName, ApplicationNode* node, std::initializer_list<std::string> theShaderNames,
+        const std::vector<std::string>& theFeedbackVaryings) :
+        Resource(theProgramName, node),
+        programName_(theProgramName),
+        shaderNames_(theShaderNames),
+        program_(0),
+        feedbackVaryings_(theFeedbackVaryings)
+    {
+        for (const auto& shaderName : shaderNames_) {
+            shaders_.emplace_back(std::make_unique<Shader>(shaderName, node));
+        }
+        program_ = linkNewProgram(programName_, shaders_, [](const std::unique_ptr<Shader>& shdr) noexcept { return shdr->getShaderId(); }, feedbackVaryings_);
     }
 
     /**
@@ -38,7 +58,8 @@ namespace viscom {
         programName_(std::move(rhs.programName_)),
         shaderNames_(std::move(rhs.shaderNames_)),
         program_(std::move(rhs.program_)),
-        shaders_(std::move(rhs.shaders_))
+        shaders_(std::move(rhs.shaders_)),
+        feedbackVaryings_(std::move(rhs.feedbackVaryings_))
     {
         rhs.program_ = 0;
     }
@@ -59,6 +80,7 @@ namespace viscom {
             program_ = rhs.program_;
             rhs.program_ = 0;
             shaders_ = std::move(rhs.shaders_);
+            feedbackVaryings_ = std::move(rhs.feedbackVaryings_);
         }
         return *this;
     }
@@ -85,10 +107,12 @@ namespace viscom {
      *  @param name the name of the program.
      *  @param shaders a list of shaders used for creating the program.
      *  @param shaderAccessor function to access the shader id from the shader object in list.
+     *  @param feedbackVaryings outputs to capture by transform feedback (may be empty).
      */
     // ReSharper restore CppDoxygenUnresolvedReference
     template<typename T, typename SHAcc>
-    GLuint GPUProgram::linkNewProgram(const std::string& name, const std::vector<T>& shaders, SHAcc shaderAccessor)
+    GLuint GPUProgram::linkNewProgram(const std::string& name, const std::vector<T>& shaders, SHAcc shaderAccessor,
+        const std::vector<std::string>& feedbackVaryings)
     {
         auto program = glCreateProgram();
         if (program == 0) {
@@ -98,6 +122,11 @@ namespace viscom {
         for (const auto& shader : shaders) {
             glAttachShader(program, shaderAccessor(shader));
         }
+        if (!feedbackVaryings.empty()) {
+            std::vector<const GLchar*> varyings;
+            for (const auto& varying : feedbackVaryings) varyings.push_back(varying.c_str());
+            glTransformFeedbackVaryings(program, static_cast<GLsizei>(varyings.size()), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+        }
         glLinkProgram(program);
 
         GLint status;
@@ -142,7 +171,7 @@ namespace viscom {
 
         GLuint tempProgram = 0;
         try {
-            tempProgram = linkNewProgram(programName_, newOGLShaders, [](GLuint shdr) noexcept { return shdr; });
+            tempProgram = linkNewProgram(programName_, newOGLShaders, [](GLuint shdr) noexcept { return shdr; }, feedbackVaryings_);
         } catch (shader_compiler_error compilerError) {
             releaseShaders(newOGLShaders);
             throw;
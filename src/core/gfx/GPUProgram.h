@@ -23,6 +23,8 @@ namespace viscom {
     {
     public:
         GPUProgram(const std::string& programName, ApplicationNode* node, std::initializer_list<std::string> shaderNames);
+        GPUProgram(const std::string& programName, ApplicationNode* node, std::initializer_list<std::string> shaderNames,
+            const std::vector<std::string>& feedbackVaryings);
         GPUProgram(const GPUProgram& orig) = delete;
         GPUProgram& operator=(const GPUProgram&) = delete;
         GPUProgram(GPUProgram&&) noexcept;
@@ -55,10 +57,12 @@ namespace viscom {
         GLuint program_;
         /** Holds a list of shaders used internally. */
         ShaderList shaders_;
+        /** Holds the names of the outputs captured by transform feedback. */
+        std::vector<std::string> feedbackVaryings_;
 
         void unload() noexcept;
         template<typename T, typename SHAcc> static GLuint linkNewProgram(const std::string& name,
-            const std::vector<T>& shaders, SHAcc shaderAccessor);
+            const std::vector<T>& shaders, SHAcc shaderAccessor, const std::vector<std::string>& feedbackVaryings);
         static void releaseShaders(const std::vector<GLuint>& shaders) noexcept;
     };
 }
@@ -13,6 +13,7 @@
 #include "core/gfx/Material.h"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
+#include <glm/gtc/matrix_inverse.hpp>
 
 #undef max
 #undef min
@@ -122,6 +123,7 @@ namespace viscom {
         }
 
         rootNode_ = std::make_unique<SceneMeshNode>(scene->mRootNode, nullptr, subMeshes_);
+        FlattenNode(rootNode_.get(), glm::mat4(1.0f));
 
         glGenBuffers(1, &indexBuffer_);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_);
@@ -139,6 +141,7 @@ namespace viscom {
         texCoords_(std::move(rhs.texCoords_)),
         indices_(std::move(rhs.indices_)),
         subMeshes_(std::move(rhs.subMeshes_)),
+        drawList_(std::move(rhs.drawList_)),
         indexBuffer_(rhs.indexBuffer_)
     {
         rhs.indexBuffer_ = 0;
@@ -158,6 +161,7 @@ namespace viscom {
             texCoords_ = std::move(rhs.texCoords_);
             indices_ = std::move(rhs.indices_);
             subMeshes_ = std::move(rhs.subMeshes_);
+            drawList_ = std::move(rhs.drawList_);
             indexBuffer_ = rhs.indexBuffer_;
             rhs.indexBuffer_ = 0;
         }
@@ -171,6 +175,23 @@ namespace viscom {
         indexBuffer_ = 0;
     }
 
+    /**
+     *  Appends the sub-meshes of a node and its children to the draw list.
+     *  The transforms are composed like the recursive node traversal did it while rendering.
+     *  @param node the node to flatten.
+     *  @param parentMatrix the composed transform of the node's parents.
+     */
+    void Mesh::FlattenNode(const SceneMeshNode* node, const glm::mat4& parentMatrix)
+    {
+        auto localMatrix = node->GetLocalTransform() * parentMatrix;
+        auto normalMatrix = glm::inverseTranspose(glm::mat3(localMatrix));
+        for (unsigned int i = 0; i < node->GetNumMeshes(); ++i) {
+            const SubMesh* subMesh = node->GetMesh(i);
+            drawList_.push_back(SubMeshDraw{ subMesh->GetIndexOffset(), subMesh->GetNumberOfIndices(), subMesh->GetMaterial(), subMesh, localMatrix, normalMatrix });
+        }
+        for (unsigned int i = 0; i < node->GetNumNodes(); ++i) FlattenNode(node->GetChild(i), localMatrix);
+    }
+
     std::shared_ptr<const Texture> Mesh::loadTexture(const std::string& relFilename, ApplicationNode* node) const
     {
         auto path = GetId().substr(0, GetId().find_last_of("/") + 1);
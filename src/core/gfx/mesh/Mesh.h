@@ -36,6 +36,22 @@ namespace viscom {
     class Mesh final : public Resource
     {
     public:
+        /** A sub-mesh draw with the transforms of its scene node (and the node's parents) already applied. */
+        struct SubMeshDraw {
+            /** The index offset the sub-mesh starts. */
+            unsigned int indexOffset;
+            /** The number of indices in the sub-mesh. */
+            unsigned int numIndices;
+            /** The sub-meshes material. */
+            const Material* material;
+            /** The sub-mesh drawn. */
+            const SubMesh* subMesh;
+            /** The local transformation matrix. */
+            glm::mat4 localMatrix;
+            /** The normal matrix (inverse transpose of the local matrix). */
+            glm::mat3 normalMatrix;
+        };
+
         Mesh(const std::string& meshFilename, ApplicationNode* node);
         Mesh(const Mesh&) = delete;
         Mesh& operator=(const Mesh&) = delete;
@@ -51,6 +67,8 @@ namespace viscom {
         /** Const accessor to the meshes sub-meshes. */
         const std::vector<SubMesh>& GetSubMeshes() const { return subMeshes_; }
         const SceneMeshNode* GetRootNode() const { return rootNode_.get(); }
+        /** The scene node tree flattened into a list of draws, in depth-first order. */
+        const std::vector<SubMeshDraw>& GetDrawList() const { return drawList_; }
 
         const std::vector<glm::vec3>& GetVertices() const { return vertices_; }
         const std::vector<glm::vec3>& GetNormals() const { return normals_; }
@@ -63,6 +81,7 @@ namespace viscom {
 
     private:
         std::shared_ptr<const Texture> loadTexture(const std::string& relFilename, ApplicationNode* node) const;
+        void FlattenNode(const SceneMeshNode* node, const glm::mat4& parentMatrix);
 
 
         /** Holds all the single points used by the mesh (and its sub-meshes) as points or in vertices. */
@@ -88,6 +107,8 @@ namespace viscom {
 
         /** The root scene node. */
         std::unique_ptr<SceneMeshNode> rootNode_;
+        /** The flattened scene node tree. */
+        std::vector<SubMeshDraw> drawList_;
 
         /** Holds the OpenGL index buffer. */
         GLuint indexBuffer_;
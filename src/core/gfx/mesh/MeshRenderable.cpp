@@ -8,7 +8,6 @@
 
 #include "MeshRenderable.h"
 #include <glm/gtc/matrix_inverse.hpp>
-#include "SceneMeshNode.h"
 #include "SubMesh.h"
 #include "core/gfx/Material.h"
 #include "core/gfx/Texture.h"
@@ -82,44 +81,41 @@ namespace viscom {
         glUseProgram(drawProgram_->getProgramId());
         glBindVertexArray(vao_);
         glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-        DrawNode(modelMatrix, mesh_->GetRootNode(), overrideBump);
+        // inverseTranspose(A * B) = inverseTranspose(A) * inverseTranspose(B), so only the model matrix is inverted here
+        auto modelNormalMatrix = glm::inverseTranspose(glm::mat3(modelMatrix));
+        for (const auto& draw : mesh_->GetDrawList())
+            DrawSubMesh(draw.localMatrix * modelMatrix, draw.normalMatrix * modelNormalMatrix, draw, overrideBump);
         glBindVertexArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
-    void MeshRenderable::DrawNode(const glm::mat4& modelMatrix, const SceneMeshNode* node, bool overrideBump) const
-    {
-        auto localMatrix = node->GetLocalTransform() * modelMatrix;
-        for (unsigned int i = 0; i < node->GetNumMeshes(); ++i) DrawSubMesh(localMatrix, node->GetMesh(i), overrideBump);
-        for (unsigned int i = 0; i < node->GetNumNodes(); ++i) DrawNode(localMatrix, node->GetChild(i), overrideBump);
-    }
-
-    void MeshRenderable::DrawSubMesh(const glm::mat4& modelMatrix, const SubMesh* subMesh, bool overrideBump) const
+    void MeshRenderable::DrawSubMesh(const glm::mat4& modelMatrix, const glm::mat3& normalMatrix, const Mesh::SubMeshDraw& draw, bool overrideBump) const
     {
+        const Material* material = draw.material;
         glUniformMatrix4fv(uniformLocations_[0], 1, GL_FALSE, glm::value_ptr(modelMatrix));
-        glUniformMatrix3fv(uniformLocations_[1], 1, GL_FALSE, glm::value_ptr(glm::inverseTranspose(glm::mat3(modelMatrix))));
+        glUniformMatrix3fv(uniformLocations_[1], 1, GL_FALSE, glm::value_ptr(normalMatrix));
 
-        if (subMesh->GetMaterial()->diffuseTex && uniformLocations_.size() > 2) {
+        if (material->diffuseTex && uniformLocations_.size() > 2) {
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, subMesh->GetMaterial()->diffuseTex->getTextureId());
+            glBindTexture(GL_TEXTURE_2D, material->diffuseTex->getTextureId());
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
             glUniform1i(uniformLocations_[2], 0);
         }
-        if (subMesh->GetMaterial()->bumpTex && uniformLocations_.size() > 3) {
+        if (material->bumpTex && uniformLocations_.size() > 3) {
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, subMesh->GetMaterial()->bumpTex->getTextureId());
+            glBindTexture(GL_TEXTURE_2D, material->bumpTex->getTextureId());
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
             glUniform1i(uniformLocations_[3], 1);
-            if (!overrideBump) glUniform1f(uniformLocations_[4], subMesh->GetMaterial()->bumpMultiplier);
+            if (!overrideBump) glUniform1f(uniformLocations_[4], material->bumpMultiplier);
         }
 
-        glDrawElements(GL_TRIANGLES, subMesh->GetNumberOfIndices(), GL_UNSIGNED_INT,
-            (static_cast<char*> (nullptr)) + (subMesh->GetIndexOffset() * sizeof(unsigned int)));
+        glDrawElements(GL_TRIANGLES, draw.numIndices, GL_UNSIGNED_INT,
+            (static_cast<char*> (nullptr)) + (draw.indexOffset * sizeof(unsigned int)));
     }
 }
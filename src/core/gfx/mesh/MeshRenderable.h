@@ -46,8 +46,6 @@ namespace viscom {
     protected:
         MeshRenderable(const Mesh* renderMesh, GLuint vBuffer, GPUProgram* program);
 
-        void DrawNode(const glm::mat4& modelMatrix, const SceneMeshNode* node, bool overrideBump = false) const;
-
         /** Holds the mesh to render. */
         const Mesh* mesh_;
         /** Holds the vertex buffer. */
@@ -59,7 +57,7 @@ namespace viscom {
         /** Holds the standard uniform bindings. */
         std::vector<GLint> uniformLocations_;
 
-        void DrawSubMesh(const glm::mat4& modelMatrix, const SubMesh* subMesh, bool overrideBump = false) const;
+        void DrawSubMesh(const glm::mat4& modelMatrix, const glm::mat3& normalMatrix, const Mesh::SubMeshDraw& draw, bool overrideBump = false) const;
     };
 
     template <class VTX>
@@ -24,4 +24,24 @@ namespace viscom {
         }
         return result;
     }
+
+    /**
+     *  Extracts the planes of the view frustum of a view projection matrix (normals point inwards).
+     *  Objects tested against it have to be in the space the matrix transforms from.
+     *  @param m the view projection matrix.
+     */
+    template<class T> Frustum<T> extractFrustum(const glm::mat4& m)
+    {
+        glm::vec4 row[4];
+        for (auto i = 0; i < 4; ++i) row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        Frustum<T> result;
+        result.left() = row[3] + row[0];
+        result.right() = row[3] - row[0];
+        result.top() = row[3] - row[1];
+        result.bttm() = row[3] + row[1];
+        result.near() = row[3] + row[2];
+        result.far() = row[3] - row[2];
+        for (auto& plane : result.planes) plane /= glm::length(glm::vec3(plane));
+        return result;
+    }
 }}